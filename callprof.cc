@@ -0,0 +1,174 @@
+/********************************************************************************************//**
+ * @file callprof.cc
+ * 
+ * A PDP-8 Simulator: class CallProfiler
+ ************************************************************************************************/
+
+#include <iomanip>
+#include <map>
+#include <vector>
+
+#include "callprof.h"
+
+using namespace std;
+
+/********************************************************************************************//**
+ * Discard all samples, and start again at ncycles
+ ************************************************************************************************/
+void CallProfiler::reset(uint64_t ncycles) {
+	nodes.clear();
+	nodes.push_back(Node(Root, 0));
+	stack.clear();
+	for (auto& st : stats)
+		st = Stats{0, 0, 0, 0};
+	cur		= 0;
+	last	= ncycles;
+}
+
+/********************************************************************************************//**
+ * Charge the cycles since the last event to the current node
+ ************************************************************************************************/
+void CallProfiler::settle(uint64_t ncycles) {
+	const uint64_t delta = ncycles - last;
+	nodes[cur].self += delta;
+	stats[nodes[cur].entry].excl += delta;
+	last = ncycles;
+}
+
+/********************************************************************************************//**
+ * JMS to entry
+ ************************************************************************************************/
+void CallProfiler::call(unsigned entry, uint64_t ncycles) {
+	settle(ncycles);
+
+	if (stats[entry].active != 0) {			// Never returned from, and now can't be
+		auto i = stack.rbegin();
+		while (nodes[i->node].entry != entry)
+			++i;
+		unwind(stack.rend() - i - 1, ncycles);
+	}
+	if (stack.size() >= Max_Depth)
+		unwind(Max_Depth - 1, ncycles);
+
+	unsigned child = 0;
+	for (unsigned n : nodes[cur].children)
+		if (nodes[n].entry == entry) {
+			child = n;
+			break;
+		}
+
+	if (child == 0) {
+		child = static_cast<unsigned>(nodes.size());
+		nodes.push_back(Node(entry, cur));
+		nodes[cur].children.push_back(child);
+	}
+
+	++nodes[child].calls;
+	++stats[entry].calls;
+	++stats[entry].active;
+	stack.push_back(Frame{child, ncycles});
+	cur = child;
+}
+
+/********************************************************************************************//**
+ * Pop the top frame
+ ************************************************************************************************/
+void CallProfiler::pop(uint64_t ncycles) {
+	const Frame f = stack.back();
+	stack.pop_back();
+
+	Stats& st = stats[nodes[f.node].entry];
+	if (--st.active == 0)					// Don't count recursive calls twice
+		st.incl += ncycles - f.start;
+
+	cur = nodes[f.node].parent;
+}
+
+/********************************************************************************************//**
+ * Pop frames, until there are depth left
+ ************************************************************************************************/
+void CallProfiler::unwind(size_t depth, uint64_t ncycles) {
+	while (stack.size() > depth)
+		pop(ncycles);
+}
+
+/********************************************************************************************//**
+ * JMP I through ptr; a return if ptr is the entry of an active call. Frames above it are assumed
+ * to have exited without returning.
+ ************************************************************************************************/
+void CallProfiler::ret(unsigned ptr, uint64_t ncycles) {
+	auto i = stack.rbegin();
+	while (i != stack.rend() && nodes[i->node].entry != ptr)
+		++i;
+
+	if (i == stack.rend())
+		return;								// Not a return, e.g., a jump table
+
+	settle(ncycles);
+	unwind(stack.rend() - i - 1, ncycles);
+}
+
+/********************************************************************************************//**
+ * Write the semicolon separated call stack for node on to os
+ ************************************************************************************************/
+void CallProfiler::path(ostream& os, unsigned node) const {
+	vector<unsigned> entries;
+	for (; node != 0; node = nodes[node].parent)
+		entries.push_back(nodes[node].entry);
+
+	os << "main";
+	for (auto i = entries.rbegin(); i != entries.rend(); ++i)
+		os << ';' << setw(4) << *i;
+}
+
+/********************************************************************************************//**
+ * Write the per subroutine inclusive and exclusive cycles, and caller -> callee call counts
+ ************************************************************************************************/
+void CallProfiler::report(ostream& os, uint64_t ncycles) {
+	settle(ncycles);
+
+	os << setfill(' ') << dec
+	   << "Entry       calls     inclusive     exclusive\n"
+	   << "main " << setw(11) << "-" << setw(14) << "-" << setw(14) << stats[Root].excl << '\n';
+
+	for (unsigned e = 0; e < NAddrs; ++e) {
+		const Stats& st = stats[e];
+		if (st.calls == 0)
+			continue;
+
+		os	<< oct << setfill('0') << setw(4) << e << ' '
+			<< dec << setfill(' ') << setw(11) << st.calls
+			<< setw(14) << st.incl << setw(14) << st.excl << '\n';
+	}
+
+	map<pair<unsigned, unsigned>, uint64_t> edges;	// (caller, callee) -> calls
+	for (const Node& n : nodes)
+		for (unsigned c : n.children)
+			edges[make_pair(n.entry, nodes[c].entry)] += nodes[c].calls;
+
+	os << "Caller -> callee      calls\n";
+	for (const auto& e : edges) {
+		if (e.first.first == Root)
+			os << "main";
+		else
+			os << oct << setfill('0') << setw(4) << e.first.first;
+		os	<< " -> " << oct << setfill('0') << setw(4) << e.first.second
+			<< dec << setfill(' ') << setw(15) << e.second << '\n';
+	}
+}
+
+/********************************************************************************************//**
+ * Write the exclusive cycles of each call stack in flamegraph "folded" format
+ ************************************************************************************************/
+void CallProfiler::folded(ostream& os, uint64_t ncycles) {
+	settle(ncycles);
+
+	for (unsigned n = 0; n < nodes.size(); ++n) {
+		if (nodes[n].self == 0)
+			continue;
+
+		os << oct << setfill('0');
+		path(os, n);
+		os << ' ' << dec << nodes[n].self << '\n';
+	}
+}
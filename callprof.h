@@ -0,0 +1,82 @@
+/********************************************************************************************//**
+ * @file callprof.h
+ * 
+ * A PDP-8 Simulator: class CallProfiler - subroutine level profiler
+ ************************************************************************************************/
+
+#ifndef	CALLPROF_H
+#define	CALLPROF_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/********************************************************************************************//**
+ * Subroutine level call profiler
+ *
+ * PDP-8 subroutines are called via JMS, which stores the return address in the entry word, and
+ * return via JMP I through the entry word. The profiler keeps a shadow call stack, and a call tree
+ * of every distinct stack seen, charging cycles only at calls and returns, so the per instruction
+ * cost is nil.
+ *
+ * Subroutines are identified by their entry word address. Cycles outside of any subroutine are
+ * charged to "main".
+ *
+ * As JMS overwrites the entry word, an active call can't be returned to once its subroutine is
+ * called again; so a call unwinds any active frame for the same entry, which also catches
+ * subroutines that exit by a direct JMP. The stack is capped at Max_Depth frames regardless.
+ ************************************************************************************************/
+class CallProfiler {
+public:
+	CallProfiler()								{	reset(0);	}
+
+	void reset(uint64_t ncycles);
+	void call(unsigned entry, uint64_t ncycles);
+	void ret(unsigned ptr, uint64_t ncycles);
+
+	void report(std::ostream& os, uint64_t ncycles);
+	void folded(std::ostream& os, uint64_t ncycles);
+
+private:
+	static const unsigned NAddrs = 4096;		///< Possible entry addresses
+	static const unsigned Root	 = NAddrs;		///< Entry "address" of main
+	static const unsigned Max_Depth = 256;		///< Maximum shadow stack depth
+
+	/// A node in the call tree; a distinct call stack
+	struct Node {
+		unsigned				entry;			///< Subroutine entry address
+		unsigned				parent;			///< Index of the caller's node
+		uint64_t				calls;			///< Number of calls
+		uint64_t				self;			///< Exclusive cycles
+		std::vector<unsigned>	children;		///< Indexes of the callee nodes
+
+		Node(unsigned e, unsigned p) : entry{e}, parent{p}, calls{0}, self{0} {}
+	};
+
+	/// An active call
+	struct Frame {
+		unsigned				node;			///< Call tree node
+		uint64_t				start;			///< Cycle count at the call
+	};
+
+	/// Per subroutine totals
+	struct Stats {
+		uint64_t				calls;			///< Number of calls
+		uint64_t				incl;			///< Inclusive cycles, of completed calls
+		uint64_t				excl;			///< Exclusive cycles
+		unsigned				active;			///< Number of active frames
+	};
+
+	std::vector<Node>			nodes;			///< Call tree, nodes[0] is main
+	std::vector<Frame>			stack;			///< Shadow call stack
+	Stats						stats[NAddrs + 1];	///< Indexed by entry, or Root
+	unsigned					cur;			///< Current node
+	uint64_t					last;			///< Cycle count at the last call/return
+
+	void settle(uint64_t ncycles);
+	void pop(uint64_t ncycles);
+	void unwind(size_t depth, uint64_t ncycles);
+	void path(std::ostream& os, unsigned node) const;
+};
+
+#endif
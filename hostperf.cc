@@ -0,0 +1,166 @@
+/********************************************************************************************//**
+ * @file hostperf.cc
+ * 
+ * A PDP-8 Simulator: class HostCounters
+ ************************************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "hostperf.h"
+
+using namespace std;
+
+/********************************************************************************************//**
+ * Open a user space only perf event, as part of group (-1 for a new group leader)
+ * @return the perf event file descriptor, or -1 on failure
+ ************************************************************************************************/
+static int perfOpen(uint32_t type, uint64_t config, int group) {
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof attr);
+
+	attr.size			= sizeof attr;
+	attr.type			= type;
+	attr.config			= config;
+	attr.read_format	= PERF_FORMAT_GROUP;
+	attr.disabled		= group == -1;			// The leader enables the group
+	attr.exclude_kernel	= 1;
+	attr.exclude_hv		= 1;
+
+	return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group, 0));
+}
+
+/********************************************************************************************//**
+ * Open the counter group, or select a fallback source
+ ************************************************************************************************/
+HostCounters::HostCounters() : src{Source::PerfEvent}, nopen{0} {
+	static const uint64_t configs[NCounters] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_MISSES,
+		PERF_COUNT_HW_CACHE_MISSES
+	};
+
+	for (unsigned i = 0; i < NCounters; ++i) {
+		fds[i]		= -1;
+		slot[i]		= 0;
+		avail[i]	= false;
+	}
+
+	fds[Cycles] = perfOpen(PERF_TYPE_HARDWARE, configs[Cycles], -1);
+	if (fds[Cycles] != -1) {
+		avail[Cycles] = true;
+		slot[Cycles] = nopen++;
+
+		for (unsigned i = Cycles + 1; i < NCounters; ++i) {
+			fds[i] = perfOpen(PERF_TYPE_HARDWARE, configs[i], fds[Cycles]);
+			if (fds[i] != -1) {				// Not all hosts count everything
+				avail[i] = true;
+				slot[i] = nopen++;
+			}
+		}
+
+		ioctl(fds[Cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(fds[Cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+	} else {
+#if defined(__x86_64__) || defined(__i386__)
+		src = Source::Rdtsc;
+#else
+		src = Source::ClockGettime;
+#endif
+		avail[Cycles] = true;
+	}
+
+	calibrate();
+}
+
+/********************************************************************************************//**
+ * Measure the cost of taking a sample; the median of back to back differences
+ ************************************************************************************************/
+void HostCounters::calibrate() {
+	const unsigned		n = 1001;
+	vector<Sample>		samples(n + 1);
+	vector<uint64_t>	deltas(n);
+
+	for (auto& sample : samples)
+		read(sample);
+
+	for (unsigned c = 0; c < NCounters; ++c) {
+		for (unsigned i = 0; i < n; ++i)
+			deltas[i] = samples[i + 1].v[c] - samples[i].v[c];
+		nth_element(deltas.begin(), deltas.begin() + n / 2, deltas.end());
+		ovh.v[c] = deltas[n / 2];
+	}
+}
+
+/********************************************************************************************//**
+ ************************************************************************************************/
+HostCounters::~HostCounters() {
+	for (unsigned i = 0; i < NCounters; ++i)
+		if (fds[i] != -1)
+			close(fds[i]);
+}
+
+/********************************************************************************************//**
+ * Read all counters in to sample; unavailable counters read as zero
+ ************************************************************************************************/
+void HostCounters::read(Sample& sample) const {
+	switch (src) {
+	case Source::PerfEvent: {
+		uint64_t buf[1 + NCounters];		// nr, followed by nr values
+		if (::read(fds[Cycles], buf, sizeof buf) > 0)
+			for (unsigned i = 0; i < NCounters; ++i)
+				sample.v[i] = avail[i] ? buf[1 + slot[i]] : 0;
+	} break;
+
+	case Source::Rdtsc:
+#if defined(__x86_64__) || defined(__i386__)
+		sample.v[Cycles] = __rdtsc();
+		break;
+#endif
+		// fall through
+
+	case Source::ClockGettime: {
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		sample.v[Cycles] = static_cast<uint64_t>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+	} break;
+	}
+}
+
+/********************************************************************************************//**
+ * @return the short name for counter c
+ ************************************************************************************************/
+const char* HostCounters::name(Counter c) {
+	switch (c) {
+	case Cycles:		return "cycles";
+	case Instructions:	return "instructions";
+	case BranchMisses:	return "branch-misses";
+	case CacheMisses:	return "cache-misses";
+	default:			return "unknown";
+	}
+}
+
+/********************************************************************************************//**
+ * @return the name of counter source s
+ ************************************************************************************************/
+const char* HostCounters::name(Source s) {
+	switch (s) {
+	case Source::PerfEvent:		return "perf_event";
+	case Source::Rdtsc:			return "rdtsc";
+	case Source::ClockGettime:	return "clock_gettime";
+	default:					return "unknown";
+	}
+}
@@ -0,0 +1,74 @@
+/********************************************************************************************//**
+ * @file hostperf.h
+ * 
+ * A PDP-8 Simulator: class HostCounters - host (Linux) performance counters
+ ************************************************************************************************/
+
+#ifndef	HOSTPERF_H
+#define	HOSTPERF_H
+
+#include <cstdint>
+
+/********************************************************************************************//**
+ * Host performance counters
+ *
+ * Reads host cycles, instructions, branch mispredicts and cache misses, as a single group, via
+ * Linux perf_event_open(2). If perf events are unavailable, falls back to counting host cycles
+ * with rdtsc, or nanoseconds with clock_gettime, and the remaining counters read as zero.
+ *
+ * Taking a sample has a cost of its own, which lands in whatever is being measured. It's measured
+ * once, as the median difference of back to back samples, so callers can subtract it with delta().
+ ************************************************************************************************/
+class HostCounters {
+public:
+	/// Counters, in group read order
+	enum Counter { Cycles, Instructions, BranchMisses, CacheMisses, NCounters };
+
+	/// Where the counters came from
+	enum class Source { PerfEvent, Rdtsc, ClockGettime };
+
+	/// A snapshot of all counters
+	struct Sample {
+		uint64_t	v[NCounters];			///< Indexed by Counter
+
+		Sample() : v{0, 0, 0, 0} {}
+	};
+
+	HostCounters();
+	~HostCounters();
+
+	HostCounters(const HostCounters&) = delete;
+	HostCounters& operator=(const HostCounters&) = delete;
+
+	/// @return the counter source
+	Source source() const				{	return src;				}
+
+	/// @return true if counter c is being counted
+	bool available(Counter c) const		{	return avail[c];		}
+
+	void read(Sample& sample) const;
+
+	/// @return the cost of taking a sample
+	const Sample& overhead() const			{	return ovh;				}
+
+	/// @return counter c's change from prev to now, less the cost of a sample
+	uint64_t delta(const Sample& now, const Sample& prev, unsigned c) const {
+		const uint64_t d = now.v[c] - prev.v[c];
+		return d > ovh.v[c] ? d - ovh.v[c] : 0;
+	}
+
+	static const char* name(Counter c);
+	static const char* name(Source s);
+
+private:
+	Source		src;						///< Counter source
+	int			fds[NCounters];				///< perf event fds, fds[0] is the group leader
+	unsigned	slot[NCounters];			///< Position of each counter in a group read
+	unsigned	nopen;						///< Number of open perf events
+	bool		avail[NCounters];			///< true if the counter is counted
+	Sample		ovh;						///< Cost of taking a sample
+
+	void calibrate();
+};
+
+#endif
@@ -0,0 +1,235 @@
+/********************************************************************************************//**
+ * @file loader.cc
+ * 
+ * A PDP-8 Simulator: BIN and RIM paper tape image loader
+ *
+ * A tape is one or more segments, separated by leader/trailer (0200) frames. Each word is two
+ * frames, six bits each, most significant first; an origin if bit 6 of the first frame is set,
+ * otherwise data. RIM format has an origin before every data word, while BIN format has runs of
+ * data words, and ends with a checksum word; the twelve bit sum of the preceding origin and data
+ * frames. BIN tapes may also have field setting frames (03x0), and rubouts (0377) are ignored.
+ *
+ * Both are decoded in a single pass; each data word is held until the next word, or the end of
+ * the segment, shows whether it's the checksum. A segment with consecutive data words is BIN,
+ * otherwise it's RIM.
+ ************************************************************************************************/
+
+#include <bitset>
+#include <cstdint>
+#include <iomanip>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "loader.h"
+
+using namespace std;
+
+const unsigned	LEADER			= 0200;		///< Leader/trailer
+const unsigned	RUBOUT			= 0377;		///< Ignored
+const unsigned	FIELD_Mask		= 0307;		///< Field setting frame...
+const unsigned	FIELD			= 0300;		///< ... is 11xxx000
+const unsigned	FIELD_Shift		= 3;
+const unsigned	CHAN8_Mask		= 0200;		///< Channel 8; leader, rubout, or field
+const unsigned	ORG_Mask		= 0100;		///< Origin
+const unsigned	DATA_Mask		= 0077;
+const unsigned	MSB_Shift		= 6;
+
+/********************************************************************************************//**
+ * Segment decoder
+ ************************************************************************************************/
+class Decoder {
+public:
+	Decoder(unsigned* m, LoadStats& s) : mem{m}, stats(s) {	start();	}
+
+	/// Start a new segment
+	void start() {
+		addr	= 0;
+		field	= 0;
+		sum		= 0;
+		held	= false;
+		half	= false;
+		prevData= false;
+		bin		= false;
+		used	= false;
+	}
+
+	/// Decode frame c, that isn't leader
+	void frame(unsigned c) {
+		if (c & CHAN8_Mask) {
+			if (c == RUBOUT)
+				;
+			else if ((c & FIELD_Mask) == FIELD) {
+				commit();					// The held word belongs to the old field
+				field = (c >> FIELD_Shift) & 07;
+			} else
+				++stats.malformed;
+			return;
+		}
+
+		used = true;
+		if (!half) {						// First frame of a word
+			first	= c;
+			half	= true;
+			return;
+		}
+		half = false;
+
+		const unsigned word = (first & DATA_Mask) << MSB_Shift | c;
+		commit();							// The held word wasn't the checksum
+
+		if (first & ORG_Mask) {
+			addr		= word;
+			prevData	= false;
+			sum			+= first + c;
+
+		} else {
+			if (prevData)
+				bin		= true;
+			prevData	= true;
+			held		= true;
+			heldWord	= word;
+			heldSum		= first + c;
+		}
+	}
+
+	/// End the segment
+	void end() {
+		if (half)
+			++stats.malformed;				// Odd frame
+
+		if (used) {
+			if (bin) {
+				++stats.bin;
+				if (held && (sum & 07777) != heldWord)
+					++stats.badChecksums;
+			} else {
+				++stats.rim;
+				commit();
+			}
+		}
+
+		start();
+	}
+
+	/// Set the loaded address ranges in stats
+	void ranges() const {
+		for (unsigned a = 0; a < loaded.size(); ++a)
+			if (loaded[a]) {
+				if (!stats.ranges.empty() && stats.ranges.back().second + 1 == a)
+					stats.ranges.back().second = a;
+				else
+					stats.ranges.push_back(make_pair(a, a));
+			}
+	}
+
+private:
+	unsigned*		mem;
+	LoadStats&		stats;
+	bitset<4096>	loaded;					///< Addresses loaded
+
+	unsigned		addr;					///< Next load address
+	unsigned		field;					///< Current field
+	unsigned		sum;					///< Checksum of the committed words
+	unsigned		first;					///< First frame of the current word
+	unsigned		heldWord;				///< Data word, not yet committed
+	unsigned		heldSum;				///< ... and its frames sum
+	bool			held;					///< heldWord is valid
+	bool			half;					///< Have the first frame of a word
+	bool			prevData;				///< Last word was data
+	bool			bin;					///< Seen consecutive data words
+	bool			used;					///< Seen a word
+
+	/// Store the held word, if any
+	void commit() {
+		if (!held)
+			return;
+		held = false;
+
+		sum += heldSum;
+		if (field == 0) {
+			mem[addr] = heldWord;
+			loaded.set(addr);
+			++stats.words;
+		} else
+			++stats.skipped;				// Only field 0 is implemented
+		addr = (addr + 1) & 07777;
+	}
+};
+
+/********************************************************************************************//**
+ * Load the BIN or RIM tape image filename in to mem, accumulating what was loaded in stats.
+ * @return false if the file can't be read
+ ************************************************************************************************/
+bool loadTape(const string& filename, unsigned* mem, LoadStats& stats) {
+	const int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return false;
+	}
+
+	const size_t len = static_cast<size_t>(st.st_size);
+	const uint8_t* tape = nullptr;
+	if (len != 0) {
+		void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+		madvise(p, len, MADV_SEQUENTIAL);
+		tape = static_cast<const uint8_t*>(p);
+	}
+	close(fd);
+
+	Decoder d{mem, stats};
+	bool leader = true;
+	for (const uint8_t* c = tape; c != tape + len; ++c) {
+		if (*c == LEADER) {
+			if (!leader)
+				d.end();
+			leader = true;
+		} else {
+			leader = false;
+			d.frame(*c);
+		}
+	}
+	d.end();								// Missing trailer
+	d.ranges();
+
+	if (tape)
+		munmap(const_cast<uint8_t*>(tape), len);
+
+	return true;
+}
+
+/********************************************************************************************//**
+ * Write a one line summary of stats; format, words and address ranges, in octal, and checksum
+ * status.
+ ************************************************************************************************/
+ostream& operator<< (ostream& os, const LoadStats& stats) {
+	if (stats.bin)
+		os << "BIN (" << stats.bin << " segments) ";
+	if (stats.rim)
+		os << "RIM (" << stats.rim << " segments) ";
+
+	os << oct << setfill('0') << stats.words << " words";
+	for (const auto& r : stats.ranges)
+		os << ' ' << setw(4) << r.first << '-' << setw(4) << r.second;
+
+	if (stats.bin && stats.badChecksums)
+		os << ", " << dec << stats.badChecksums << " bad checksums";
+	else if (stats.bin)
+		os << ", checksums ok";
+	if (stats.malformed)
+		os << ", " << dec << stats.malformed << " malformed frames";
+	if (stats.skipped)
+		os << ", " << oct << stats.skipped << " words for other fields skipped";
+
+	return os << dec;
+}
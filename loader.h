@@ -0,0 +1,37 @@
+/********************************************************************************************//**
+ * @file loader.h
+ * 
+ * A PDP-8 Simulator: loadTape() - BIN and RIM paper tape image loader
+ ************************************************************************************************/
+
+#ifndef	LOADER_H
+#define	LOADER_H
+
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/********************************************************************************************//**
+ * What loadTape() loaded
+ ************************************************************************************************/
+struct LoadStats {
+	unsigned	bin;						///< BIN segments
+	unsigned	rim;						///< RIM segments
+	unsigned	words;						///< Words loaded
+	unsigned	badChecksums;				///< BIN segments with a bad checksum
+	unsigned	malformed;					///< Malformed frames, ignored
+	unsigned	skipped;					///< Words for fields other than 0, not loaded
+	std::vector<std::pair<unsigned, unsigned>>	ranges;	///< Loaded address ranges, inclusive
+
+	LoadStats() : bin{0}, rim{0}, words{0}, badChecksums{0}, malformed{0}, skipped{0} {}
+};
+
+bool loadTape(const std::string& filename, unsigned* mem, LoadStats& stats);
+
+/********************************************************************************************//**
+ * ostream put operator
+ ************************************************************************************************/
+std::ostream& operator<< (std::ostream& os, const LoadStats& stats);
+
+#endif
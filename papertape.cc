@@ -0,0 +1,175 @@
+/********************************************************************************************//**
+ * @file papertape.cc
+ * 
+ * A PDP-8 Simulator: PC8-E high speed paper tape reader and punch
+ ************************************************************************************************/
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "papertape.h"
+
+using namespace std;
+
+/// Processor cycles per second, at 1.5 us per cycle
+static const uint64_t Cycles_Per_Sec = 1000000 * 2 / 3;
+
+/********************************************************************************************//**
+ * Mount the tape image in filename
+ * @return false if the file can't be opened or mapped
+ ************************************************************************************************/
+bool PaperTapeReader::attach(const string& filename) {
+	detach();
+
+	const int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return false;
+	}
+
+	const size_t len = static_cast<size_t>(st.st_size);
+	if (len != 0) {							// Can't map an empty file
+		void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+		madvise(p, len, MADV_SEQUENTIAL);
+
+		tape = static_cast<const uint8_t*>(p);
+	} else {
+		static const uint8_t empty = 0;
+		tape = &empty;
+	}
+
+	close(fd);								// The mapping remains valid
+
+	pos		= tape;
+	end		= tape + len;
+	busy	= false;
+	return true;
+}
+
+/********************************************************************************************//**
+ * Unmount the tape, if any
+ ************************************************************************************************/
+void PaperTapeReader::detach() {
+	if (tape && end != tape)
+		munmap(const_cast<uint8_t*>(tape), end - tape);
+	tape = pos = end = nullptr;
+	busy = false;
+}
+
+/********************************************************************************************//**
+ * Set the reader speed, in characters per second, or zero for unthrottled
+ ************************************************************************************************/
+void PaperTapeReader::speed(unsigned cps) {
+	charCycles = cps ? Cycles_Per_Sec / cps : 0;
+}
+
+/********************************************************************************************//**
+ * Reader fetch character; clear the flag and read the next character in to the buffer. The flag
+ * never sets if we're out of tape.
+ ************************************************************************************************/
+void PaperTapeReader::fetch(uint64_t ncycles) {
+	busy = false;
+	if (pos != end) {
+		buf		= *pos++;
+		busy	= true;
+		readyAt	= ncycles + charCycles;
+	}
+}
+
+/********************************************************************************************//**
+ ************************************************************************************************/
+PaperTapeReader::Snapshot PaperTapeReader::snapshot() const {
+	return Snapshot{static_cast<size_t>(pos - tape), buf, busy, readyAt};
+}
+
+/********************************************************************************************//**
+ ************************************************************************************************/
+void PaperTapeReader::restore(const Snapshot& snap) {
+	if (tape && snap.pos <= static_cast<size_t>(end - tape))
+		pos = tape + snap.pos;
+	buf		= snap.buf;
+	busy	= snap.busy;
+	readyAt	= snap.readyAt;
+}
+
+/********************************************************************************************//**
+ * Punch in to filename, which is created, or truncated
+ * @return false if the file can't be created
+ ************************************************************************************************/
+bool PaperTapePunch::attach(const string& filename) {
+	detach();
+
+	fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	busy = false;
+	return fd != -1;
+}
+
+/********************************************************************************************//**
+ * Write the punched tape, and close the output file
+ * @return false if the write failed
+ ************************************************************************************************/
+bool PaperTapePunch::detach() {
+	bool ok = true;
+
+	if (fd != -1) {
+		const uint8_t* p = out.data();
+		for (size_t n = out.size(); n != 0; ) {
+			const ssize_t w = write(fd, p, n);
+			if (w <= 0) {
+				ok = false;
+				break;
+			}
+			p += w;
+			n -= w;
+		}
+
+		close(fd);
+		fd = -1;
+	}
+
+	out.clear();
+	busy = false;
+	return ok;
+}
+
+/********************************************************************************************//**
+ * Set the punch speed, in characters per second, or zero for unthrottled
+ ************************************************************************************************/
+void PaperTapePunch::speed(unsigned cps) {
+	charCycles = cps ? Cycles_Per_Sec / cps : 0;
+}
+
+/********************************************************************************************//**
+ * Punch c, setting the flag when done. Characters punched with no tape are lost.
+ ************************************************************************************************/
+void PaperTapePunch::punch(unsigned c, uint64_t ncycles) {
+	if (fd != -1)
+		out.push_back(static_cast<uint8_t>(c));
+	busy	= true;
+	readyAt	= ncycles + charCycles;
+}
+
+/********************************************************************************************//**
+ ************************************************************************************************/
+PaperTapePunch::Snapshot PaperTapePunch::snapshot() const {
+	return Snapshot{out.size(), busy, readyAt};
+}
+
+/********************************************************************************************//**
+ ************************************************************************************************/
+void PaperTapePunch::restore(const Snapshot& snap) {
+	if (snap.len <= out.size())
+		out.resize(snap.len);
+	busy	= snap.busy;
+	readyAt	= snap.readyAt;
+}
@@ -0,0 +1,110 @@
+/********************************************************************************************//**
+ * @file papertape.h
+ * 
+ * A PDP-8 Simulator: PC8-E high speed paper tape reader and punch
+ ************************************************************************************************/
+
+#ifndef	PAPERTAPE_H
+#define	PAPERTAPE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/********************************************************************************************//**
+ * PC8-E high speed paper tape reader
+ *
+ * The tape image is mmap'ed, so reading a character is a pointer bump. Timing is in processor
+ * cycles; a fetched character sets the flag after cps characters per second worth of cycles, or
+ * immediately if cps is zero.
+ ************************************************************************************************/
+class PaperTapeReader {
+public:
+	/// Device state, for checkpoints
+	struct Snapshot {
+		size_t		pos;					///< Offset of the next character
+		unsigned	buf;					///< Reader buffer
+		bool		busy;					///< Fetching, or fetched, a character
+		uint64_t	readyAt;				///< Cycle count when the flag sets
+	};
+
+	PaperTapeReader() : tape{nullptr}, pos{nullptr}, end{nullptr}, buf{0}, busy{false},
+						readyAt{0}, charCycles{0} {}
+	~PaperTapeReader()						{	detach();					}
+
+	PaperTapeReader(const PaperTapeReader&) = delete;
+	PaperTapeReader& operator=(const PaperTapeReader&) = delete;
+
+	bool attach(const std::string& filename);
+	void detach();
+	void speed(unsigned cps);
+
+	/// @return the reader flag
+	bool flag(uint64_t ncycles) const		{	return busy && ncycles >= readyAt;	}
+
+	/// @return the reader buffer
+	unsigned buffer() const					{	return buf;					}
+
+	/// Clear the reader flag
+	void clear()							{	busy = false;				}
+
+	void fetch(uint64_t ncycles);
+
+	Snapshot snapshot() const;
+	void restore(const Snapshot& snap);
+
+private:
+	const uint8_t*	tape;					///< Mapped tape image, or nullptr
+	const uint8_t*	pos;					///< Next character
+	const uint8_t*	end;					///< End of tape
+	unsigned		buf;					///< Reader buffer
+	bool			busy;					///< Fetching, or fetched, a character
+	uint64_t		readyAt;				///< Cycle count when the flag sets
+	uint64_t		charCycles;				///< Cycles per character
+};
+
+/********************************************************************************************//**
+ * PC8-E high speed paper tape punch
+ *
+ * Punched characters are appended to an in memory buffer, which is written to the output file
+ * when detached. Timing as for the reader.
+ ************************************************************************************************/
+class PaperTapePunch {
+public:
+	/// Device state, for checkpoints
+	struct Snapshot {
+		size_t		len;					///< Characters punched
+		bool		busy;					///< Punching, or punched, a character
+		uint64_t	readyAt;				///< Cycle count when the flag sets
+	};
+
+	PaperTapePunch() : fd{-1}, busy{false}, readyAt{0}, charCycles{0} {}
+	~PaperTapePunch()						{	detach();					}
+
+	PaperTapePunch(const PaperTapePunch&) = delete;
+	PaperTapePunch& operator=(const PaperTapePunch&) = delete;
+
+	bool attach(const std::string& filename);
+	bool detach();
+	void speed(unsigned cps);
+
+	/// @return the punch flag
+	bool flag(uint64_t ncycles) const		{	return busy && ncycles >= readyAt;	}
+
+	/// Clear the punch flag
+	void clear()							{	busy = false;				}
+
+	void punch(unsigned c, uint64_t ncycles);
+
+	Snapshot snapshot() const;
+	void restore(const Snapshot& snap);
+
+private:
+	int						fd;				///< Output file, or -1
+	std::vector<uint8_t>	out;			///< Punched characters
+	bool					busy;			///< Punching, or punched, a character
+	uint64_t				readyAt;		///< Cycle count when the flag sets
+	uint64_t				charCycles;		///< Cycles per character
+};
+
+#endif
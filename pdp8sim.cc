@@ -4,15 +4,27 @@
  * A PDP-8 Simulator
  ************************************************************************************************/
 
+#include <algorithm>
+#include <bitset>
 #include <cassert>
+#include <cerrno>
 #include <cstdint>
 #include <fstream>
 #include <iomanip>
 #include <ios>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "callprof.h"
+#include "hostperf.h"
+#include "loader.h"
 #include "opcode.h"
+#include "papertape.h"
+#include "rk8e.h"
+#include "shmview.h"
 #include "state.h"
 
 using namespace std;
@@ -58,6 +70,7 @@ const unsigned GRP1_IAC			= 07001;	///< Increment AC, sequence 3
 // OPER Group 2
 
 const unsigned GROUP2			= 00400;	///< Bit 3 is set, bit 11 is clear.
+const unsigned GROUP3			= 00401;	///< Bit 3 and 11 are set.
 
 const unsigned	GRP2_SKP_BIT	= 00010;	///< Skip bit for bits 5-7
 
@@ -78,6 +91,16 @@ const unsigned	IOT_DEV_SEL		= 00770;	///< Device ID
 const unsigned	IOT_DEV_SHIFT	= 3;
 
 const unsigned	IOT_OP			= 00007;	///< Operations
+const unsigned	IOT_IOP1		= 00001;	///< First IOP pulse
+const unsigned	IOT_IOP2		= 00002;	///< Second IOP pulse
+const unsigned	IOT_IOP4		= 00004;	///< Third IOP pulse
+
+const unsigned	DEV_READER		= 001;		///< High speed paper tape reader
+const unsigned	DEV_PUNCH		= 002;		///< High speed paper tape punch
+const unsigned	DEV_DISK		= 074;		///< RK8E disk controller
+
+const unsigned	Reader_CPS		= 300;		///< Realistic reader speed, characters per second
+const unsigned	Punch_CPS		= 50;		///< Realistic punch speed, characters per second
 
 /********************************************************************************************//**
  * PDP8 Registers
@@ -123,10 +146,57 @@ static bool        	run 		= false;
 static Switches    	sw;
 static Registers	r;
 static State       	s			= State::Fetch;
-static unsigned    	mem[4096];
-static unsigned		ncycles 	= 0;
-static unsigned		ninstr		= 0;
-    
+static unsigned		localMem[4096];
+static unsigned*   	mem			= localMem;	///< localMem, or the shared memory view's
+static uint64_t		ncycles 	= 0;
+static uint64_t		ninstr		= 0;
+
+static bool			batch		= false;	///< Run without the front panel, dump JSON on halt
+
+static PaperTapeReader	reader;
+static PaperTapePunch	punch;
+static RK8E				disk;
+static ShmView			shm;
+
+static bool			callProf	= false;	///< Profile JMS/JMP I calls?
+static CallProfiler	callProfiler;
+
+/************************************************************************************************
+ * Host performance instrumentation
+ ************************************************************************************************/
+
+/// Instruction classes; MRI's, OPR by group, and IOT by device
+enum InstrClass {
+	Class_OPR1	= 6,						///< After AND..JMP
+	Class_OPR2,
+	Class_OPR3,
+	Class_IOT,								///< ...followed by the remaining 63 devices
+	NClasses	= Class_IOT + 64
+};
+
+const unsigned	NStates			= 6;		///< Number of States
+
+/// Host counter totals for a instruction class in a given state
+struct HostPerfBucket {
+	uint64_t				ncycles;		///< Memory cycles
+	HostCounters::Sample	host;			///< Host counter deltas
+
+	HostPerfBucket() : ncycles{0} {}
+};
+
+static bool					hostPerf 	= false;	///< Instrument process()?
+static HostPerfBucket		hostPerfTbl[NClasses][NStates];
+static unsigned				hostPerfClass = 0;	///< Class of the current instruction
+static HostCounters::Sample	hostPerfLast;		///< Sample at the end of the last cycle
+
+/********************************************************************************************//**
+ * @return the host counters, opened on first use
+ ************************************************************************************************/
+static HostCounters& hostCounters() {
+	static HostCounters counters;
+	return counters;
+}
+
 /********************************************************************************************//**
  ************************************************************************************************/
 static void ral() {
@@ -244,6 +314,47 @@ static void oper(unsigned instr) {
 		assert(false);						// Other groups are not implenentated
 }
 
+/********************************************************************************************//**
+ * Input/Output Transfer. IOTs for devices that aren't present are ignored.
+ ************************************************************************************************/
+static void iot(unsigned instr) {
+	const unsigned dev	= (instr & IOT_DEV_SEL) >> IOT_DEV_SHIFT;
+	const unsigned ops	= instr & IOT_OP;
+
+	switch (dev) {
+	case DEV_READER:
+		if ((ops & IOT_IOP1) && reader.flag(ncycles))	// RSF
+			++r.pc;
+		if (ops & IOT_IOP2) {							// RRB
+			r.ac |= reader.buffer();
+			reader.clear();
+		}
+		if (ops & IOT_IOP4)								// RFC
+			reader.fetch(ncycles);
+		break;
+
+	case DEV_PUNCH:
+		if ((ops & IOT_IOP1) && punch.flag(ncycles))	// PSF
+			++r.pc;
+		if (ops & IOT_IOP2)								// PCF
+			punch.clear();
+		if (ops & IOT_IOP4)								// PPC
+			punch.punch(r.ac & 0377, ncycles);
+		break;
+
+	case DEV_DISK: {
+		unsigned ac = r.ac, nbreak = 0;
+		if (disk.iot(ops, ac, mem, ncycles, nbreak))
+			++r.pc;
+		r.ac = ac;
+		ncycles += nbreak;					// Data break cycles
+	} break;
+
+	default:
+		break;
+	}
+}
+
 /********************************************************************************************//**
  * Decode a instruction
  ************************************************************************************************/
@@ -261,10 +372,60 @@ static Decoded decode(unsigned instr) {
 	return d;
 }
 
+/********************************************************************************************//**
+ * @return the InstrClass of instr
+ ************************************************************************************************/
+static unsigned instrClass(unsigned instr) {
+	const OpCode op = static_cast<OpCode>((instr & Op_Mask) >> Op_Shift);
+
+	switch (op) {
+	case OpCode::OPR:
+		if ((instr & GROUP1) == 0)				return Class_OPR1;
+		else if ((instr & GROUP3) == GROUP3)	return Class_OPR3;
+		else									return Class_OPR2;
+
+	case OpCode::IOT:
+		return Class_IOT + ((instr & IOT_DEV_SEL) >> IOT_DEV_SHIFT);
+
+	default:
+		return static_cast<unsigned>(op);
+	}
+}
+
+/************************************************************************************************
+ * Execution core
+ *
+ * fetch(), defer(), execute() and the run loop are templates on a set of observer Features, and
+ * every set is instantiated. process() selects the instantiation when it (re)starts the processor,
+ * so the plain, Feature-less, core has no per instruction feature tests.
+ ************************************************************************************************/
+
+/// Observer features
+enum Feature {
+	Feat_Trace		= 1 << 0,				///< Disassemble each instruction as it's fetched
+	Feat_CallProf	= 1 << 1,				///< Subroutine call profiler
+	Feat_HostPerf	= 1 << 2,				///< Host performance counters
+	Feat_Breaks		= 1 << 3,				///< Breakpoints
+	Feat_Record		= 1 << 4,				///< Record/replay
+	Feat_Step		= 1 << 5,				///< Single step, or single instruction
+	Feat_Shm		= 1 << 6,				///< Shared memory live view
+	NFeatureSets	= 1 << 7
+};
+
+static bool				trace		= false;	///< Trace instructions?
+static bitset<4096>		breaks;					///< Breakpoint addresses
+
+static void disasm(unsigned addr, unsigned instr);
+
 /********************************************************************************************//**
  * Fetch next instruction, handle JMP direct
  ************************************************************************************************/
-void fetch() {
+template <unsigned F> static void fetch() {
+	if (F & Feat_Trace) {
+		disasm(r.pc, mem[r.pc]);
+		cout << oct << setfill('0') << "   L " << r.l << " AC " << setw(4) << r.ac << '\n';
+	}
+
 	++ninstr;
 
 	r.md 			= mem[r.pc++];
@@ -273,7 +434,7 @@ void fetch() {
 	r.ma 			= d.eaddr;
 
     if (r.ir == OpCode::IOT) {			// IOT?
-		assert(false);					// ... not implemented!
+		iot(r.md);
         s = State::Fetch;
 
 	} else if (r.ir == OpCode::OPR) {		// OPR?
@@ -294,13 +455,15 @@ void fetch() {
 /********************************************************************************************//**
  * Defer state
  ************************************************************************************************/
-void defer() {
+template <unsigned F> static void defer() {
 	r.md = mem[r.ma];					// Fetch indirect operand
 
 	if (r.ma >= 010 && r.ma <= 017)
 		mem[r.ma] = ++r.md;				// Auto increment
 
 	if (r.ir == OpCode::JMP) {			// JMP indirect?
+		if (F & Feat_CallProf)
+			callProfiler.ret(r.ma, ncycles);
 		r.pc = r.md;
 		s = State::Fetch;
 
@@ -313,7 +476,7 @@ void defer() {
 /********************************************************************************************//**
  * Execute state
  ************************************************************************************************/
-void execute() {
+template <unsigned F> static void execute() {
     r.md = mem[r.ma];
 
     switch(r.ir) {
@@ -341,6 +504,8 @@ void execute() {
 		break;
 
     case OpCode::JMS:
+		if (F & Feat_CallProf)
+			callProfiler.call(r.ma, ncycles);
 		mem[r.ma] = r.pc;
 		r.pc = ++r.ma;
 		break;
@@ -364,7 +529,7 @@ void execute() {
 /********************************************************************************************//**
  * Break (DMA) state
  ************************************************************************************************/
-void brk() {
+static void brk() {
 	assert(false);			// Not implemented
     s = State::Fetch;
 }
@@ -483,6 +648,534 @@ static void dumpState() {
 	}
 }
 
+/********************************************************************************************//**
+ * @return the name of instruction class c
+ ************************************************************************************************/
+static string className(unsigned c) {
+	ostringstream oss;
+
+	if (c < Class_OPR1)			oss << static_cast<OpCode>(c);
+	else if (c < Class_IOT)		oss << "OPR" << c - Class_OPR1 + 1;
+	else						oss << "IOT" << oct << setfill('0') << setw(2) << c - Class_IOT;
+
+	return oss.str();
+}
+
+/********************************************************************************************//**
+ * Sum the host performance buckets for class c (all states), or state st (all classes)
+ ************************************************************************************************/
+static HostPerfBucket classTotal(unsigned c) {
+	HostPerfBucket t;
+	for (unsigned st = 0; st < NStates; ++st) {
+		t.ncycles += hostPerfTbl[c][st].ncycles;
+		for (unsigned i = 0; i < HostCounters::NCounters; ++i)
+			t.host.v[i] += hostPerfTbl[c][st].host.v[i];
+	}
+
+	return t;
+}
+
+static HostPerfBucket stateTotal(unsigned st) {
+	HostPerfBucket t;
+	for (unsigned c = 0; c < NClasses; ++c) {
+		t.ncycles += hostPerfTbl[c][st].ncycles;
+		for (unsigned i = 0; i < HostCounters::NCounters; ++i)
+			t.host.v[i] += hostPerfTbl[c][st].host.v[i];
+	}
+
+	return t;
+}
+
+/********************************************************************************************//**
+ * Print the host performance report; host counts per emulated instruction, by class and state
+ ************************************************************************************************/
+static void perfReport() {
+	const HostCounters& hc = hostCounters();
+	const unsigned fetch = static_cast<unsigned>(State::Fetch);
+	const streamsize prec = cout.precision();
+
+	cout << dec << setfill(' ') << "Host counters: " << HostCounters::name(hc.source())
+		 << ", less per sample overhead of";
+	for (unsigned i = 0; i < HostCounters::NCounters; ++i) {
+		const HostCounters::Counter ctr = static_cast<HostCounters::Counter>(i);
+		if (hc.available(ctr))
+			cout << ' ' << hc.overhead().v[i] << ' ' << HostCounters::name(ctr);
+	}
+	cout << '\n';
+
+	cout << left << setw(6) << "Class" << right << setw(12) << "instrs" << setw(12) << "mcycles";
+	for (unsigned i = 0; i < HostCounters::NCounters; ++i) {
+		const HostCounters::Counter ctr = static_cast<HostCounters::Counter>(i);
+		if (hc.available(ctr))
+			cout << setw(16) << HostCounters::name(ctr) << setw(10) << "/instr";
+	}
+	cout << '\n';
+
+	for (unsigned c = 0; c < NClasses; ++c) {
+		const HostPerfBucket t = classTotal(c);
+		if (t.ncycles == 0)
+			continue;
+
+		const uint64_t n = hostPerfTbl[c][fetch].ncycles;
+		cout << left << setw(6) << className(c) << right << setw(12) << n << setw(12) << t.ncycles;
+		for (unsigned i = 0; i < HostCounters::NCounters; ++i)
+			if (hc.available(static_cast<HostCounters::Counter>(i)))
+				cout	<< setw(16) << t.host.v[i]
+						<< setw(10) << fixed << setprecision(1) << (n ? double(t.host.v[i]) / n : 0.0);
+		cout << '\n';
+	}
+
+	cout << left << setw(6) << "State" << right << setw(24) << "mcycles";
+	for (unsigned i = 0; i < HostCounters::NCounters; ++i) {
+		const HostCounters::Counter ctr = static_cast<HostCounters::Counter>(i);
+		if (hc.available(ctr))
+			cout << setw(16) << HostCounters::name(ctr) << setw(10) << "/mcycle";
+	}
+	cout << '\n';
+
+	for (unsigned st = 0; st < NStates; ++st) {
+		const HostPerfBucket t = stateTotal(st);
+		if (t.ncycles == 0)
+			continue;
+
+		cout << left << setw(6) << static_cast<State>(st) << right << setw(24) << t.ncycles;
+		for (unsigned i = 0; i < HostCounters::NCounters; ++i)
+			if (hc.available(static_cast<HostCounters::Counter>(i)))
+				cout	<< setw(16) << t.host.v[i]
+						<< setw(10) << fixed << setprecision(1) << double(t.host.v[i]) / t.ncycles;
+		cout << '\n';
+	}
+
+	cout.unsetf(ios::floatfield);
+	cout.precision(prec);
+}
+
+/********************************************************************************************//**
+ * Write a host performance bucket's counters as a JSON object
+ ************************************************************************************************/
+static void bucketJSON(const HostPerfBucket& b) {
+	const HostCounters& hc = hostCounters();
+
+	cout << "\"mcycles\": " << b.ncycles;
+	for (unsigned i = 0; i < HostCounters::NCounters; ++i) {
+		const HostCounters::Counter ctr = static_cast<HostCounters::Counter>(i);
+		if (hc.available(ctr))
+			cout << ", \"" << HostCounters::name(ctr) << "\": " << b.host.v[i];
+	}
+}
+
+/********************************************************************************************//**
+ * Dump the processor state, and the host performance report if enabled, as JSON
+ ************************************************************************************************/
+static void dumpJSON() {
+	cout	<< dec
+			<< "{\n"
+			<< "  \"pc\": "		<< r.pc		<< ",\n"
+			<< "  \"l\": "		<< r.l		<< ",\n"
+			<< "  \"ac\": "		<< r.ac		<< ",\n"
+			<< "  \"ma\": "		<< r.ma		<< ",\n"
+			<< "  \"md\": "		<< r.md		<< ",\n"
+			<< "  \"sr\": "		<< r.sr		<< ",\n"
+			<< "  \"ninstr\": "	<< ninstr	<< ",\n"
+			<< "  \"ncycles\": "	<< ncycles;
+
+	if (hostPerf) {
+		const unsigned fetch = static_cast<unsigned>(State::Fetch);
+		const char* sep = "\n";
+
+		cout << ",\n  \"hostperf\": {\n"
+			 << "    \"source\": \"" << HostCounters::name(hostCounters().source()) << "\",\n"
+			 << "    \"overhead\": { ";
+		HostPerfBucket ovh;
+		ovh.host = hostCounters().overhead();
+		bucketJSON(ovh);
+		cout << " },\n"
+			 << "    \"classes\": [";
+		for (unsigned c = 0; c < NClasses; ++c) {
+			const HostPerfBucket t = classTotal(c);
+			if (t.ncycles == 0)
+				continue;
+
+			cout	<< sep << "      { \"class\": \"" << className(c) << "\", \"instrs\": "
+					<< hostPerfTbl[c][fetch].ncycles << ", ";
+			bucketJSON(t);
+			cout	<< " }";
+			sep = ",\n";
+		}
+
+		cout << "\n    ],\n    \"states\": [";
+		sep = "\n";
+		for (unsigned st = 0; st < NStates; ++st) {
+			const HostPerfBucket t = stateTotal(st);
+			if (t.ncycles == 0)
+				continue;
+
+			cout << sep << "      { \"state\": \"" << static_cast<State>(st) << "\", ";
+			bucketJSON(t);
+			cout << " }";
+			sep = ",\n";
+		}
+		cout << "\n    ]\n  }";
+	}
+
+	cout << "\n}\n";
+}
+
+/********************************************************************************************//**
+ * Run one memory cycle. With Feat_HostPerf, the host counter deltas are charged to the current
+ * instruction class and state; note that the cost of reading the counters is included.
+ ************************************************************************************************/
+template <unsigned F> static void cycle() {
+	HostPerfBucket* b = nullptr;
+	if (F & Feat_HostPerf) {
+		if (s == State::Fetch)
+			hostPerfClass = instrClass(mem[r.pc]);
+		b = &hostPerfTbl[hostPerfClass][static_cast<unsigned>(s)];
+	}
+
+	switch(s) {
+	case State::Fetch:      fetch<F>();		break;
+	case State::Defer:      defer<F>();		break;
+	case State::Execute:    execute<F>();	break;
+	case State::Break:      brk();			break;
+	default: cerr << "unknown state!\n";
+	}
+
+	++ncycles;
+
+	if (F & Feat_HostPerf) {
+		HostCounters::Sample now;
+		hostCounters().read(now);
+
+		++b->ncycles;
+		for (unsigned i = 0; i < HostCounters::NCounters; ++i)
+			b->host.v[i] += hostCounters().delta(now, hostPerfLast, i);
+		hostPerfLast = now;
+	}
+}
+
+/************************************************************************************************
+ * Record/replay
+ *
+ * While recording, every front panel input that changes the machine (the SR, load address,
+ * examine and start) is logged, along with the instruction count it was applied at, and a
+ * checkpoint of memory and registers is taken every Ckpt_Interval instructions. A continue, at
+ * the end of the recording, is logged too, so replay runs on past a HLT only where the recorded
+ * run did. Everything else is deterministic, so any earlier instruction can be reached by
+ * restoring the nearest checkpoint and replaying forward, applying the logged inputs as they come
+ * due. Except for disk contents, which aren't checkpointed; so recording is refused while a disk
+ * is writable.
+ *
+ * After going back, running forward again replays the recorded inputs, until a new input is
+ * entered, which discards the recorded future.
+ *
+ * Each checkpoint costs about 16 KB, so at most Max_Ckpts are kept; beyond that, every other one
+ * in the older half is dropped. So recent checkpoints stay Ckpt_Interval apart, while older ones
+ * get further apart, and slower to replay from, as they age.
+ ************************************************************************************************/
+
+const unsigned	Ckpt_Interval	= 100000;	///< Instructions between checkpoints
+const size_t	Max_Ckpts		= 1024;		///< Checkpoints kept, about 16 MB
+
+/// A front panel input; the registers and state after the input
+struct Event {
+	uint64_t	ninstr;						///< Applied after ninstr instructions
+	Registers	r;
+	State		s;
+	bool		run;
+};
+
+/// A machine snapshot, at an instruction boundary
+struct Checkpoint {
+	uint64_t			ninstr;
+	uint64_t			ncycles;
+	Registers			r;
+	bool				run;
+	size_t				nevents;			///< Events applied before the checkpoint
+	PaperTapeReader::Snapshot	reader;
+	PaperTapePunch::Snapshot	punch;
+	RK8E::Snapshot				disk;
+	vector<unsigned>	mem;
+};
+
+static bool					record		= false;	///< Recording?
+static vector<Event>		events;					///< Recorded inputs
+static size_t				nextEvent	= 0;		///< Next event to apply
+static vector<Checkpoint>	ckpts;					///< Checkpoints, in ninstr order
+static uint64_t				nextMark	= 0;		///< ninstr of the next event or checkpoint
+static uint64_t				recEnd		= 0;		///< ninstr of the end of the recording
+
+/********************************************************************************************//**
+ * Compute nextMark
+ ************************************************************************************************/
+static void updateMark() {
+	nextMark = ckpts.back().ninstr + Ckpt_Interval;
+	if (nextEvent < events.size() && events[nextEvent].ninstr < nextMark)
+		nextMark = events[nextEvent].ninstr;
+}
+
+/********************************************************************************************//**
+ * Drop every other checkpoint in the older half, keeping the first; the start of the recording
+ ************************************************************************************************/
+static void thin() {
+	const size_t half = ckpts.size() / 2;
+	size_t n = 1;
+	for (size_t i = 1; i < ckpts.size(); ++i)
+		if (i >= half || i % 2 == 0)
+			ckpts[n++] = move(ckpts[i]);
+
+	ckpts.erase(ckpts.begin() + n, ckpts.end());
+}
+
+/********************************************************************************************//**
+ * Take a checkpoint
+ ************************************************************************************************/
+static void checkpoint() {
+	Checkpoint ck;
+	ck.ninstr	= ninstr;
+	ck.ncycles	= ncycles;
+	ck.r		= r;
+	ck.run		= run;
+	ck.nevents	= nextEvent;
+	ck.reader	= reader.snapshot();
+	ck.punch	= punch.snapshot();
+	ck.disk		= disk.snapshot();
+	ck.mem.assign(mem, mem + 4096);
+	ckpts.push_back(move(ck));
+
+	if (ckpts.size() > Max_Ckpts)
+		thin();
+}
+
+/********************************************************************************************//**
+ * Start recording from the current instruction boundary; checkpoints can only be restored at one
+ ************************************************************************************************/
+static void startRecord() {
+	if (s != State::Fetch) {
+		cerr << "Can't start recording mid instruction; continue to the next fetch first!\n";
+		record = false;
+		return;
+	}
+
+	if (disk.writable()) {
+		cerr << "Can't record while a disk is mounted writable!\n";
+		record = false;
+		return;
+	}
+
+	record = true;
+	events.clear();
+	nextEvent = 0;
+	ckpts.clear();
+	checkpoint();
+	recEnd = ninstr;
+	updateMark();
+}
+
+/********************************************************************************************//**
+ * At an instruction boundary, where ninstr >= nextMark; apply any due events, and take a
+ * checkpoint if one is due, and this is beyond the recorded checkpoints.
+ ************************************************************************************************/
+static void recordMark() {
+	for (; nextEvent < events.size() && events[nextEvent].ninstr <= ninstr; ++nextEvent) {
+		r	= events[nextEvent].r;
+		s	= events[nextEvent].s;
+		run	= events[nextEvent].run;
+	}
+
+	if (ninstr >= ckpts.back().ninstr + Ckpt_Interval)
+		checkpoint();
+
+	updateMark();
+}
+
+/********************************************************************************************//**
+ * Log a front panel input, discarding any recorded future.
+ ************************************************************************************************/
+static void recordInput() {
+	if (!record)
+		return;
+
+	events.resize(nextEvent);
+	while (ckpts.back().ninstr > ninstr)
+		ckpts.pop_back();
+
+	events.push_back(Event{ninstr, r, s, run});
+	nextEvent = events.size();
+	recEnd = ninstr;
+	updateMark();
+}
+
+/********************************************************************************************//**
+ * Events are applied at instruction boundaries, so inputs can't be recorded mid instruction
+ * @return false, after writing a diagnostic, if recording, and not at an instruction boundary
+ ************************************************************************************************/
+static bool recordable() {
+	if (record && s != State::Fetch) {
+		cerr << "Can't record an input mid instruction; continue to the next fetch first!\n";
+		return false;
+	}
+
+	return true;
+}
+
+/********************************************************************************************//**
+ * Log a continue, if at the end of the recording; the recorded future already has its own
+ ************************************************************************************************/
+static void recordContinue() {
+	if (record && s == State::Fetch && nextEvent == events.size() && ninstr >= recEnd)
+		recordInput();
+}
+
+/********************************************************************************************//**
+ * Media was mounted or unmounted, which the checkpoints can't restore; if recording, start over
+ * from here.
+ ************************************************************************************************/
+static void restartRecord() {
+	if (record) {
+		cerr << "Media changed, restarting the recording\n";
+		startRecord();
+	}
+}
+
+/********************************************************************************************//**
+ * Restore checkpoint ck
+ ************************************************************************************************/
+static void restore(const Checkpoint& ck) {
+	ninstr		= ck.ninstr;
+	ncycles		= ck.ncycles;
+	r			= ck.r;
+	s			= State::Fetch;
+	run			= ck.run;
+	nextEvent	= ck.nevents;
+	reader.restore(ck.reader);
+	punch.restore(ck.punch);
+	disk.restore(ck.disk);
+	copy(ck.mem.begin(), ck.mem.end(), mem);
+	updateMark();
+}
+
+/********************************************************************************************//**
+ * Replay forward, from an instruction boundary, to the boundary after target instructions, or
+ * until the processor halts.
+ * @return With Feat_Breaks, the last boundary before target where the PC is at a breakpoint, or
+ * 		   target if there isn't one.
+ ************************************************************************************************/
+template <unsigned F> static uint64_t forward(uint64_t target) {
+	uint64_t hit = target;
+
+	for (;;) {
+		if (ninstr >= nextMark)
+			recordMark();
+		if (ninstr == target || !run)
+			break;
+		if ((F & Feat_Breaks) && breaks[r.pc])
+			hit = ninstr;
+
+		do
+			cycle<0>();
+		while (s != State::Fetch);
+	}
+
+	return hit;
+}
+
+/********************************************************************************************//**
+ * @return true if recording, and target is in the recording
+ ************************************************************************************************/
+static bool recorded(uint64_t target) {
+	if (!record) {
+		cerr << "Not recording!\n";
+		return false;
+	}
+
+	if (target < ckpts.front().ninstr) {
+		cerr << "Recording starts at instruction " << oct << ckpts.front().ninstr << "!\n";
+		return false;
+	}
+
+	return true;
+}
+
+/********************************************************************************************//**
+ * Go to the instruction boundary after target instructions, by restoring the nearest checkpoint
+ * and replaying forward; no further than the end of the recording, or a HLT.
+ ************************************************************************************************/
+static void replay(uint64_t target) {
+	if (!recorded(target))
+		return;
+
+	if (target > recEnd) {
+		cerr << "Recording ends at instruction " << oct << recEnd << "!\n";
+		target = recEnd;
+	}
+
+	auto ck = ckpts.end();
+	while ((--ck)->ninstr > target)
+		;
+
+	restore(*ck);
+	forward<0>(target);
+	run = false;
+
+	if (callProf)							// The profile can't follow time backwards
+		callProfiler.reset(ncycles);
+}
+
+/********************************************************************************************//**
+ * Reverse continue; go back to the last breakpoint before the current instruction, or to the start
+ * of the recording. Each checkpoint interval is searched in turn, latest first.
+ ************************************************************************************************/
+static void rcont() {
+	const uint64_t now = ninstr;
+	if (!recorded(now))
+		return;
+
+	auto ck = ckpts.end();
+	while ((--ck)->ninstr >= now && ck != ckpts.begin())
+		;
+
+	for (uint64_t end = now; ; end = ck->ninstr, --ck) {
+		restore(*ck);
+		const uint64_t hit = forward<Feat_Breaks>(end);
+		if (hit != end) {
+			replay(hit);
+			return;
+		}
+
+		if (ck == ckpts.begin())
+			break;
+	}
+
+	replay(ckpts.front().ninstr);
+}
+
+/********************************************************************************************//**
+ * Parse s, as an octal number no greater than max, in to value
+ * @return false, after writing a diagnostic, if s isn't octal, or is greater than max
+ ************************************************************************************************/
+static bool octal(const string& s, uint64_t max, uint64_t& value) {
+	if (s.empty() || s.find_first_not_of("01234567") != string::npos) {
+		cerr << "'" << s << "' isn't an octal number!\n";
+		return false;
+	}
+
+	bool range = true;
+	try {
+		value = std::stoull(s, nullptr, 8);
+
+	} catch (std::out_of_range const& ex) {
+		range = false;
+	}
+
+	if (!range || value > max) {
+		cerr << "'" << s << "' is greater than " << oct << max << "!\n";
+		return false;
+	}
+
+	return true;
+}
+
 /********************************************************************************************//**
  * @return true if s is a number
  ************************************************************************************************/
@@ -496,8 +1189,10 @@ static bool digit(const string& s) {
 		else if (i < INT12_MIN)
 			cerr << "'" << i << "i is less than " << UINT12_MAX << "\n";
 
-		else
+		else if (recordable()) {
 			r.sr = i;
+			recordInput();
+		}
 
 	} catch (std::invalid_argument const& ex) {
         return false;							// Ignore, not a "digit"
@@ -525,34 +1220,132 @@ static bool frontpanel() {
 	if (cmd == "") 
 		cmd = lcmd;							// Repeat last...
 
-	if (	 cmd == "c" || cmd == "cont")	run = true;
+	string verb, arg;						// For commands with an argument
+	istringstream{cmd} >> verb >> arg;
+
+	if (	 cmd == "c" || cmd == "cont") {
+		run = true;
+		recordContinue();
+	}
+	else if (verb == "b" || verb == "break") {
+		uint64_t a;
+		if (arg != "") {
+			if (octal(arg, UINT12_MAX, a))
+				breaks.set(a);
+		} else
+			for (unsigned a = 0; a < breaks.size(); ++a)
+				if (breaks[a])
+					cout << oct << setfill('0') << setw(4) << a << '\n';
+	} else if (verb == "nobreak") {
+		uint64_t a;
+		if (arg == "")
+			breaks.reset();
+		else if (octal(arg, UINT12_MAX, a))
+			breaks.reset(a);
+	}
+	else if (cmd == "callprof") {
+		callProf = true;
+		callProfiler.reset(ncycles);
+	} else if (cmd == "nocallprof")				callProf = false;
+	else if (cmd == "calls")					callProfiler.report(cout, ncycles);
+	else if (verb == "folded") {
+		ofstream ofs{arg};
+		if (!ofs)
+			cerr << "Can't open '" << arg << "'!\n";
+		else
+			callProfiler.folded(ofs, ncycles);
+	}
 	else if (cmd == "?" || cmd == "h" || cmd == "help") {
 		cout	<< "number      -- Set Sr\n"
 				<< "?|h[elp]    -- Print help\n"
+				<< "b[reak] [addr] -- Set a breakpoint at addr (octal), or list breakpoints\n"
+				<< "nobreak [addr] -- Clear the breakpoint at addr, or all breakpoints\n"
+				<< "[no]callprof -- Subroutine call profiler\n"
+				<< "calls       -- Print subroutine call profile\n"
 				<< "c[ont]      -- Continue\n"
 				<< "e[examine]  -- Examine memory\n"
+				<< "folded file -- Write call profile stacks, in flamegraph folded format, to file\n"
+				<< "[no]hostperf -- Host performance counters\n"
+				<< "goto n      -- Go to instruction n (octal), replaying the recording\n"
 				<< "la          -- Load Address\n"
 				<< "ldaddr      -- Load Address\n"
+				<< "perf        -- Print host performance report\n"
+				<< "punch [file] -- Write the punched tape, and start punching in to file\n"
+				<< "reader [file] -- Mount file in the paper tape reader, or unmount\n"
+				<< "rkn [file]  -- Mount file on RK05 drive n (0-3), or unmount\n"
+				<< "rcont       -- Reverse continue, to the last breakpoint, or the recording start\n"
+				<< "[no]record  -- Record inputs and checkpoints, for reverse execution\n"
+				<< "rstep       -- Reverse step one instruction\n"
 				<< "[no]sinstr  -- Single Instruction\n"
 				<< "[no]sstep   -- Single Step\n"
 				<< "s[tart]     -- Start\n"
+				<< "[no]trace   -- Trace instructions\n"
 				<< "q[uit]      -- Exit\n"
 				<< "<return>    -- Same as cont\n"
 				<< "<ctrl-d>    -- Same as q[uit]\n";
 	} else if (cmd == "e" || cmd == "examine") {
-		r.md = mem[r.pc];
-		r.ma = r.pc++;
-	} else if (cmd == "la" || cmd == "ldaddr")	r.pc = r.sr;
+		if (recordable()) {
+			r.md = mem[r.pc];
+			r.ma = r.pc++;
+			recordInput();
+		}
+	} else if (verb == "goto" && arg != "") {
+		uint64_t n;
+		if (octal(arg, UINT64_MAX, n))
+			replay(n);
+	}
+	else if (cmd == "la" || cmd == "ldaddr") {
+		if (recordable()) {
+			r.pc = r.sr;
+			recordInput();
+		}
+	} else if (cmd == "record")					startRecord();
+	else if (cmd == "norecord")					record = false;
+	else if (cmd == "rcont")					rcont();
+	else if (cmd == "rstep")					replay(ninstr ? ninstr - 1 : 0);
+	else if (cmd == "hostperf") {
+		hostPerf = true;
+		for (auto& c : hostPerfTbl)
+			for (auto& b : c)
+				b = HostPerfBucket();
+	} else if (cmd == "nohostperf")				hostPerf = false;
+	else if (cmd == "perf")						perfReport();
+	else if (verb == "punch") {
+		if (!punch.detach())
+			cerr << "Can't write the punched tape!\n";
+		if (arg != "" && !punch.attach(arg))
+			cerr << "Can't create '" << arg << "'!\n";
+		restartRecord();
+	} else if (verb.size() == 3 && verb.compare(0, 2, "rk") == 0 && verb[2] >= '0'
+			   && verb[2] < '0' + int(RK8E::NDrives)) {
+		const unsigned drive = verb[2] - '0';
+		if (!disk.detach(drive))
+			cerr << "Can't write back drive " << drive << "!\n";
+		if (arg != "" && !disk.attach(drive, arg))
+			cerr << "Can't open '" << arg << "'!\n";
+		restartRecord();
+	} else if (verb == "reader") {
+		if (arg == "")
+			reader.detach();
+		else if (!reader.attach(arg))
+			cerr << "Can't open '" << arg << "'!\n";
+		restartRecord();
+	}
+	else if (cmd == "trace")					trace = true;
+	else if (cmd == "notrace")					trace = false;
 	else if (cmd == "nosinstr")					sw.sinstr = false;
 	else if (cmd == "nosstep")					sw.sstep = false;
 	else if (cmd == "sinstr")					sw.sinstr = true;
 	else if (cmd == "sstep")					sw.sstep = true;
 	else if (cmd == "s" || cmd == "start") {
-		r.l				= false;
-		r.ac = r.md 	= 0;
-		r.ma 			= r.pc;
-		s 				= State::Fetch;
-		run 			= true;
+		if (recordable()) {
+			r.l				= false;
+			r.ac = r.md 	= 0;
+			r.ma 			= r.pc;
+			s 				= State::Fetch;
+			run 			= true;
+			recordInput();
+		}
 	} else if (cmd == "q" || cmd == "quit")				return true;
 	else if (digit(cmd))
 		;
@@ -564,99 +1357,124 @@ static bool frontpanel() {
 	return false;
 }
 
+/********************************************************************************************//**
+ * Publish the registers and counters to the shared memory live view
+ ************************************************************************************************/
+static void publish() {
+	shm.publish(ShmView::Registers{
+		r.pc, r.ac, r.l, r.ma, r.md, r.sr, static_cast<unsigned>(r.ir), static_cast<unsigned>(s),
+		ninstr, ncycles
+	});
+}
+
+/********************************************************************************************//**
+ * Run the processor until it halts, hits a breakpoint, or completes a step
+ ************************************************************************************************/
+template <unsigned F> static void runCore() {
+	if (F & Feat_HostPerf)
+		hostCounters().read(hostPerfLast);
+
+	do {							// Next instruction (mem[r.pc])
+		do {						// 	Next memory state
+			cycle<F>();
+		} while (run && !((F & Feat_Step) && sw.sstep) && s != State::Fetch);
+
+		if ((F & Feat_Record) && s == State::Fetch && ninstr >= nextMark)
+			recordMark();
+
+		if ((F & Feat_Breaks) && s == State::Fetch && breaks[r.pc]) {
+			cout << "Breakpoint at " << oct << setfill('0') << setw(4) << r.pc << '\n';
+			run = false;
+		}
+
+		if ((F & Feat_Shm) && (ninstr & (ShmView::PublishInterval - 1)) == 0)
+			publish();
+	} while (run && !(F & Feat_Step));
+
+	if (F & Feat_Step)
+		run = false;
+}
+
+/// Run loop instantiation
+typedef void (*Core)();
+
+/********************************************************************************************//**
+ * Fill cores[0..F] with runCore<0>..runCore<F>
+ ************************************************************************************************/
+template <unsigned F> struct CoreTable {
+	static void fill(Core* cores) {
+		cores[F] = runCore<F>;
+		CoreTable<F - 1>::fill(cores);
+	}
+};
+
+template <> struct CoreTable<0> {
+	static void fill(Core* cores) {	cores[0] = runCore<0>;	}
+};
+
+/********************************************************************************************//**
+ * @return the currently enabled Features
+ ************************************************************************************************/
+static unsigned features() {
+	unsigned f = 0;
+
+	if (trace)						f |= Feat_Trace;
+	if (callProf)					f |= Feat_CallProf;
+	if (hostPerf)					f |= Feat_HostPerf;
+	if (breaks.any())				f |= Feat_Breaks;
+	if (record)						f |= Feat_Record;
+	if (sw.sstep || sw.sinstr)		f |= Feat_Step;
+	if (shm.memory())				f |= Feat_Shm;
+
+	return f;
+}
+
 /********************************************************************************************//**
  * Run the processor/debugger...
  ************************************************************************************************/
 int process() {
-	run = false;					// Processor starts in idle mode...
+	Core cores[NFeatureSets];
+	CoreTable<NFeatureSets - 1>::fill(cores);
+
+	run = batch;					// Processor starts in idle mode, unless in batch mode...
     for (;;) {
 		if (run) {
-            do {					// Next instruction (mem[r.pc])
-                do {				// 	Next memory state
-                    switch(s) {
-                    case State::Fetch:      fetch();    break;
-                    case State::Defer:      defer();    break;
-                    case State::Execute:    execute();  break;
-                    case State::Break:      brk();      break;
-                    default: cerr << "unknown state!\n";
-                    }
+			cores[features()]();
+			if (record && ninstr > recEnd)
+				recEnd = ninstr;
+			if (shm.memory())
+				publish();
 
-					++ncycles;
+			if (!run)
+				disk.flush();		// Write back on halt
 
-                } while (run && !sw.sstep && s != State::Fetch);
-            } while (run && !sw.sinstr && !sw.sstep);
+		} else if (batch) {
+			dumpJSON();
+			return 0;
 
-            run = run && !sw.sstep && !sw.sinstr;
+        } else {
+			if (shm.memory())
+				publish();
 
-        } else if (frontpanel())
-			return 0;
+			if (frontpanel())
+				return 0;
+		}
 
 		// else: keep going...
 	}
 }
 
 /********************************************************************************************//**
- * Load a BIN file into memory
+ * Load a BIN or RIM file into memory, reporting what was loaded on standard error
  ************************************************************************************************/
-static bool load_BIN (const string& filename) {
-	enum class BIN_State { Leader, OriginMSB, OriginLSB, DataMSB, DataLSB, Trailer };
-
-	ifstream ifs{filename};
-	if (!ifs) {
+static bool load(const string& filename) {
+	LoadStats stats;
+	if (!loadTape(filename, mem, stats)) {
 		cerr << progName << ": can't open '" << filename << "'!\n";
 		return false;
 	}
 
-	const unsigned BIN_LEADER 		= 00200;
-	const unsigned BIN_ORG_Mask		= 00100;
-	const unsigned BIN_DATA_Mask	= 00077;
-	const unsigned BIN_MSB_Shift	= 6;
-
-	unsigned	data = 0;
-	uint8_t		byte;
-	char		c;
-	BIN_State	s = BIN_State::DataMSB;
-
-	while (ifs.get(c)) {
-		byte = static_cast<uint8_t>(c);
-
-		if (byte == BIN_LEADER)
-			continue;
-
-		if ((byte & BIN_ORG_Mask) == BIN_ORG_Mask)
-			s = BIN_State::OriginMSB;
-
-		switch (s) {
-			case BIN_State::Leader:
-				assert(false);
-				break;
-
-			case BIN_State::OriginMSB:
-				r.pc = (byte & BIN_DATA_Mask) << BIN_MSB_Shift;
-				s = BIN_State::OriginLSB;
-				break;
-
-			case BIN_State::OriginLSB:
-				r.pc |= byte;
-				s = BIN_State::DataMSB;
-				break;
-
-			case BIN_State::DataMSB:
-				data = (byte & BIN_DATA_Mask) << BIN_MSB_Shift;
-				s = BIN_State::DataLSB;
-				break;
-
-			case BIN_State::DataLSB:
-				data |= byte;
-				mem[r.pc++] = data;
-				s = BIN_State::DataMSB;
-				break;
-
-			default:
-				assert(false);
-		}
-	}
-
+	cerr << progName << ": " << filename << ": " << stats << '\n';
 	return true;
 }
 
@@ -666,16 +1484,30 @@ static bool load_BIN (const string& filename) {
 static void help() {
 	cerr	<< "Usage: " << progName << " [options... | filenames...]\n"
 			<< "Where options is zero or more of:\n"
+			<< "-b addr  -- batch mode; run from addr (octal) until halt, then dump state as JSON\n"
+			<< "-d file  -- mount file on the next RK05 drive, starting with 0\n"
+			<< "-f file  -- profile subroutine calls, writing folded call stacks to file on exit\n"
 			<< "-h|?     -- print this message, and return 1\n"
+			<< "-m name  -- share memory, registers and counters in POSIX shared memory /name\n"
+			<< "-p file  -- punch paper tape in to file\n"
+			<< "-P       -- count host performance counters per instruction class and state\n"
+			<< "-r file  -- mount file in the paper tape reader\n"
+			<< "-R       -- record from the start, for reverse execution\n"
+			<< "-s       -- realistic paper tape speeds, rather than unthrottled\n"
+			<< "-t       -- trace instructions\n"
 			<< "-v       -- print the version, and return 1\n"
 			<< '\n'
-			<< "And where filenames is zero or more program file names to load in BIN format\n";
+			<< "And where filenames is zero or more program file names to load in BIN or RIM format\n";
 }
 
 /********************************************************************************************//**
  * The PDP8 simulator
  ************************************************************************************************/
 int main (int argc, char** argv) {
+	uint64_t start = 0;						// Batch mode start address
+	unsigned ndisks = 0;					// RK05 drives mounted
+	string foldedFile;						// Call profile output
+
 	for (int argn = 1; argn < argc; ++argn) {
 		const string arg = argv[argn];
 
@@ -691,6 +1523,86 @@ int main (int argc, char** argv) {
 
 				switch(c) {
 					case '?': case 'h': help();			return 1;
+					case 'P': hostPerf = true;			break;
+					case 'R': record = true;			break;
+					case 't': trace = true;				break;
+
+					case 's':
+						reader.speed(Reader_CPS);
+						punch.speed(Punch_CPS);
+						break;
+
+					case 'p':
+						if (++argn == argc) {
+							cerr << progName << ": -p requires a file name.\n";
+							return 1;
+						}
+						if (!punch.attach(argv[argn])) {
+							cerr << progName << ": can't create '" << argv[argn] << "'!\n";
+							return 1;
+						}
+						break;
+
+					case 'm':
+						if (++argn == argc) {
+							cerr << progName << ": -m requires a shared memory name.\n";
+							return 1;
+						}
+						if (!shm.attach(argv[argn], mem)) {
+							if (errno == EEXIST)
+								cerr << progName << ": shared memory '" << argv[argn]
+									 << "' is in use, or left by a crashed run; remove /dev/shm/"
+									 << (argv[argn] + (argv[argn][0] == '/')) << " if so.\n";
+							else
+								cerr << progName << ": can't create shared memory '" << argv[argn] << "'!\n";
+							return 1;
+						}
+						mem = shm.memory();
+						break;
+
+					case 'd':
+						if (++argn == argc) {
+							cerr << progName << ": -d requires a file name.\n";
+							return 1;
+						}
+						if (!disk.attach(ndisks++, argv[argn])) {
+							cerr << progName << ": can't mount '" << argv[argn] << "'!\n";
+							return 1;
+						}
+						break;
+
+					case 'r':
+						if (++argn == argc) {
+							cerr << progName << ": -r requires a file name.\n";
+							return 1;
+						}
+						if (!reader.attach(argv[argn])) {
+							cerr << progName << ": can't open '" << argv[argn] << "'!\n";
+							return 1;
+						}
+						break;
+
+					case 'f':
+						if (++argn == argc) {
+							cerr << progName << ": -f requires a file name.\n";
+							return 1;
+						}
+						callProf	= true;
+						foldedFile	= argv[argn];
+						break;
+
+					case 'b':
+						if (++argn == argc) {
+							cerr << progName << ": -b requires a start address.\n";
+							return 1;
+						}
+						if (!octal(argv[argn], UINT12_MAX, start)) {
+							cerr << progName << ": -b requires an octal start address.\n";
+							return 1;
+						}
+						batch	= true;
+						break;
+
 					case 'v': cout << "version 0.6\n";	return 1;
 					default:
 						cerr << progName << ": unknown option '" << c << "'.\n";
@@ -699,10 +1611,39 @@ int main (int argc, char** argv) {
 			}
 
 			
-		} else if (!load_BIN(arg))
+		} else if (!load(arg))
+			return 1;
+	}
+
+	if (batch)
+		r.pc = start;
+
+	if (record)
+		startRecord();
+
+	int status = process();
+
+	disk.poll(mem, UINT64_MAX);				// Complete any transfer in progress...
+	for (unsigned d = 0; d < RK8E::NDrives; ++d)
+		if (!disk.detach(d)) {				// ... and write back
+			cerr << progName << ": can't write back drive " << d << "!\n";
+			status = 1;
+		}
+
+	if (!punch.detach()) {
+		cerr << progName << ": can't write the punched tape!\n";
+		status = 1;
+	}
+
+	if (!foldedFile.empty()) {
+		ofstream ofs{foldedFile};
+		if (!ofs) {
+			cerr << progName << ": can't open '" << foldedFile << "'!\n";
 			return 1;
+		}
+		callProfiler.folded(ofs, ncycles);
 	}
 
-	return process();
+	return status;
 }
 
@@ -0,0 +1,439 @@
+/********************************************************************************************//**
+ * @file rk8e.cc
+ * 
+ * A PDP-8 Simulator: class RK8E
+ ************************************************************************************************/
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rk8e.h"
+
+using namespace std;
+
+/************************************************************************************************
+ * IOT operations, device 74
+ ************************************************************************************************/
+
+const unsigned	DSKP			= 1;		///< Skip on done, or error
+const unsigned	DCLR			= 2;		///< Clear, per AC bits 10-11
+const unsigned	DLAG			= 3;		///< Load disk address, and go
+const unsigned	DLCA			= 4;		///< Load current address
+const unsigned	DRST			= 5;		///< Read status
+const unsigned	DLDC			= 6;		///< Load command
+
+/************************************************************************************************
+ * Command register
+ ************************************************************************************************/
+
+const unsigned	CMD_FUNC		= 07000;	///< Function
+const unsigned	CMD_FUNC_SHIFT	= 9;
+const unsigned	CMD_SKDN		= 00200;	///< Set done on seek done
+const unsigned	CMD_HALF		= 00100;	///< Half (128 word) block
+const unsigned	CMD_UNIT		= 00006;	///< Drive select
+const unsigned	CMD_UNIT_SHIFT	= 1;
+const unsigned	CMD_CYHI		= 00001;	///< Cylinder address MSB
+
+const unsigned	FUNC_READ		= 0;		///< Read data
+const unsigned	FUNC_RALL		= 1;		///< Read all
+const unsigned	FUNC_WLK		= 2;		///< Set write protect
+const unsigned	FUNC_SEEK		= 3;		///< Seek only
+const unsigned	FUNC_WRITE		= 4;		///< Write data
+const unsigned	FUNC_WALL		= 5;		///< Write all
+
+/************************************************************************************************
+ * Status register
+ ************************************************************************************************/
+
+const unsigned	STA_DONE		= 04000;	///< Status (done)
+const unsigned	STA_HMOV		= 02000;	///< Heads in motion
+const unsigned	STA_SKFL		= 00400;	///< Seek fail
+const unsigned	STA_NRDY		= 00200;	///< File not ready
+const unsigned	STA_BUSY		= 00100;	///< Control busy error
+const unsigned	STA_TMO			= 00040;	///< Timing error
+const unsigned	STA_WLK			= 00020;	///< Write lock error
+const unsigned	STA_CRC			= 00010;	///< CRC error
+const unsigned	STA_DLT			= 00004;	///< Data request late
+const unsigned	STA_STAT		= 00002;	///< Drive status error
+const unsigned	STA_CYL			= 00001;	///< Cylinder address error
+
+const unsigned	STA_ERR			= STA_SKFL | STA_NRDY | STA_BUSY | STA_TMO | STA_WLK | STA_CRC
+								| STA_DLT | STA_STAT | STA_CYL;
+
+/************************************************************************************************
+ * RK05 timing, in 1.5 us cycles
+ ************************************************************************************************/
+
+const uint64_t	Seek_Settle		= 6667;		///< 10 ms to start, and settle, a seek
+const uint64_t	Seek_Per_Cyl	= 100;		///< ... plus 0.15 ms per cylinder
+const uint64_t	Latency			= 13333;	///< 20 ms, average rotational latency
+const uint64_t	Word_Cycles		= 7;		///< 11 us per word transferred
+
+const unsigned	Block_Bytes		= RK8E::Block_Words * 2;	///< Bytes per block in an image
+
+/********************************************************************************************//**
+ * Start the worker
+ ************************************************************************************************/
+RK8E::RK8E() : idle{true}, writeFailed{false} {
+	memset(&regs, 0, sizeof regs);
+	for (auto& d : drives) {
+		d.fd		= -1;
+		d.locked	= false;
+	}
+
+	worker = thread(&RK8E::run, this);
+}
+
+/********************************************************************************************//**
+ * Write back, and stop the worker
+ ************************************************************************************************/
+RK8E::~RK8E() {
+	for (unsigned d = 0; d < NDrives; ++d)
+		detach(d);
+
+	queue(Job{Job::Stop, 0, 0});
+	worker.join();
+}
+
+/********************************************************************************************//**
+ * Mount the cartridge image filename on drive, creating it if need be. Read only images are
+ * write locked.
+ * @return false if the image can't be opened
+ ************************************************************************************************/
+bool RK8E::attach(unsigned drive, const string& filename) {
+	if (drive >= NDrives)
+		return false;
+
+	detach(drive);
+
+	Drive& d = drives[drive];
+	d.locked = false;
+	d.fd = open(filename.c_str(), O_RDWR | O_CREAT, 0666);
+	if (d.fd == -1) {
+		d.locked = true;
+		d.fd = open(filename.c_str(), O_RDONLY);
+		if (d.fd == -1)
+			return false;
+	}
+
+	d.cache.assign(NBlocks, Block());
+	return true;
+}
+
+/********************************************************************************************//**
+ * Write back, and unmount drive
+ * @return false if the write back failed; the drive is unmounted regardless
+ ************************************************************************************************/
+bool RK8E::detach(unsigned drive) {
+	if (drive >= NDrives || drives[drive].fd == -1)
+		return true;
+
+	bool ok = sync();
+
+	Drive& d = drives[drive];
+	if (close(d.fd) == -1)
+		ok = false;
+	d.fd = -1;
+	d.cache.clear();
+	return ok;
+}
+
+/********************************************************************************************//**
+ * @return true if any drive is mounted, and not write locked
+ ************************************************************************************************/
+bool RK8E::writable() const {
+	for (const auto& d : drives)
+		if (d.fd != -1 && !d.locked)
+			return true;
+
+	return false;
+}
+
+/********************************************************************************************//**
+ * Queue a write back of all dirty blocks
+ ************************************************************************************************/
+void RK8E::flush() {
+	for (unsigned d = 0; d < NDrives; ++d)
+		if (drives[d].fd != -1)
+			queue(Job{Job::Flush, d, 0});
+}
+
+/********************************************************************************************//**
+ * Write back all dirty blocks, and wait for the worker to finish
+ * @return false if any write back, including asynchronous ones since the last sync(), failed
+ ************************************************************************************************/
+bool RK8E::sync() {
+	flush();
+
+	unique_lock<mutex> lock{mtx};
+	ready.wait(lock, [this] { return jobs.empty() && idle; });
+
+	const bool ok = !writeFailed;
+	writeFailed = false;
+	return ok;
+}
+
+/********************************************************************************************//**
+ * Queue job for the worker
+ ************************************************************************************************/
+void RK8E::queue(const Job& job) {
+	lock_guard<mutex> lock{mtx};
+	jobs.push_back(job);
+	idle = false;
+	work.notify_one();
+}
+
+/********************************************************************************************//**
+ * The worker
+ ************************************************************************************************/
+void RK8E::run() {
+	unique_lock<mutex> lock{mtx};
+
+	for (;;) {
+		while (jobs.empty()) {
+			idle = true;
+			ready.notify_all();
+			work.wait(lock);
+		}
+
+		const Job job = jobs.front();
+		jobs.pop_front();
+		if (job.kind == Job::Stop)
+			return;
+
+		lock.unlock();
+		if (job.kind == Job::Read)
+			load(job.drive, job.block);
+		else
+			writeBack(job.drive);
+		lock.lock();
+	}
+}
+
+/********************************************************************************************//**
+ * Worker: read block in to the cache. Short reads, past the end of the image, read as zero.
+ ************************************************************************************************/
+void RK8E::load(unsigned drive, unsigned block) {
+	uint8_t buf[Block_Bytes];
+	memset(buf, 0, sizeof buf);
+	if (pread(drives[drive].fd, buf, sizeof buf, off_t(block) * Block_Bytes) == -1)
+		memset(buf, 0, sizeof buf);
+
+	lock_guard<mutex> lock{mtx};
+	Block& b = drives[drive].cache[block];
+	if (!b.loaded) {						// ... unless written in the meantime
+		for (unsigned i = 0; i < Block_Words; ++i)
+			b.w[i] = (buf[2 * i] | buf[2 * i + 1] << 8) & 07777;
+		b.loaded = true;
+	}
+	ready.notify_all();
+}
+
+/********************************************************************************************//**
+ * Worker: write back drive's dirty blocks. Each is marked clean once written, unless it's been
+ * written to again in the meantime.
+ ************************************************************************************************/
+void RK8E::writeBack(unsigned drive) {
+	vector<unsigned>	blocks;
+	vector<unsigned>	gens;
+	vector<uint8_t>		bufs;
+
+	{
+		lock_guard<mutex> lock{mtx};
+		vector<Block>& cache = drives[drive].cache;
+		for (unsigned n = 0; n < cache.size(); ++n) {
+			Block& b = cache[n];
+			if (!b.dirty)
+				continue;
+
+			for (unsigned i = 0; i < Block_Words; ++i) {
+				bufs.push_back(b.w[i] & 0377);
+				bufs.push_back(b.w[i] >> 8);
+			}
+			blocks.push_back(n);
+			gens.push_back(b.gen);
+		}
+	}
+
+	for (unsigned i = 0; i < blocks.size(); ++i) {
+		const bool ok = pwrite(drives[drive].fd, &bufs[i * Block_Bytes], Block_Bytes,
+							   off_t(blocks[i]) * Block_Bytes) == Block_Bytes;
+
+		lock_guard<mutex> lock{mtx};
+		if (!ok) {
+			writeFailed = true;				// Leave the rest dirty, for the next try
+			break;
+		}
+
+		Block& b = drives[drive].cache[blocks[i]];
+		if (b.gen == gens[i])
+			b.dirty = false;
+	}
+}
+
+/********************************************************************************************//**
+ * Start the command register's function on the disk address (DLAG)
+ ************************************************************************************************/
+void RK8E::go(uint64_t ncycles) {
+	const unsigned func		= (regs.cmd & CMD_FUNC) >> CMD_FUNC_SHIFT;
+	const unsigned unit		= (regs.cmd & CMD_UNIT) >> CMD_UNIT_SHIFT;
+	const unsigned block	= (regs.cmd & CMD_CYHI) << 12 | regs.da;
+	const unsigned cyl		= block >> 5;
+	Drive& d = drives[unit];
+
+	if (regs.busy)							{	regs.status |= STA_DONE | STA_BUSY;	return;	}
+	if (d.fd == -1)							{	regs.status |= STA_DONE | STA_NRDY;	return;	}
+	if (func > FUNC_WALL)					{	regs.status |= STA_DONE | STA_STAT;	return;	}
+	if (func == FUNC_WLK) {
+		d.locked = true;
+		regs.status |= STA_DONE;
+		return;
+	}
+	if (cyl >= NCylinders)					{	regs.status |= STA_DONE | STA_CYL;	return;	}
+	if ((func == FUNC_WRITE || func == FUNC_WALL) && d.locked) {
+		regs.status |= STA_DONE | STA_WLK;
+		return;
+	}
+
+	const unsigned dist = cyl > regs.cyl[unit] ? cyl - regs.cyl[unit] : regs.cyl[unit] - cyl;
+	uint64_t t = dist ? Seek_Settle + dist * Seek_Per_Cyl : 0;
+	regs.cyl[unit] = cyl;
+
+	if (func != FUNC_SEEK) {
+		const unsigned nwords = regs.cmd & CMD_HALF ? Block_Words / 2 : Block_Words;
+		t += Latency + nwords * Word_Cycles;
+
+		if (func == FUNC_READ || func == FUNC_RALL) {
+			bool queued;
+			{
+				lock_guard<mutex> lock{mtx};
+				Block& b = d.cache[block];
+				queued	= b.valid;
+				b.valid	= true;
+			}
+			if (!queued)
+				queue(Job{Job::Read, unit, block});
+		}
+	}
+
+	regs.busy	= true;
+	regs.doneAt	= ncycles + t;
+}
+
+/********************************************************************************************//**
+ * Complete the transfer in progress, waiting for the worker if the block isn't loaded yet.
+ * @return the number of data break cycles
+ ************************************************************************************************/
+unsigned RK8E::transfer(unsigned* mem) {
+	const unsigned func		= (regs.cmd & CMD_FUNC) >> CMD_FUNC_SHIFT;
+	const unsigned unit		= (regs.cmd & CMD_UNIT) >> CMD_UNIT_SHIFT;
+	const unsigned block	= (regs.cmd & CMD_CYHI) << 12 | regs.da;
+	const unsigned nwords	= regs.cmd & CMD_HALF ? Block_Words / 2 : Block_Words;
+
+	if (drives[unit].fd == -1) {			// Unmounted mid transfer
+		regs.status |= STA_NRDY;
+		return 0;
+	}
+
+	unique_lock<mutex> lock{mtx};
+	Block& b = drives[unit].cache[block];
+
+	if (func == FUNC_READ || func == FUNC_RALL) {
+		if (!b.valid) {						// Not queued, e.g., restored from a checkpoint
+			b.valid = true;
+			jobs.push_back(Job{Job::Read, unit, block});
+			idle = false;
+			work.notify_one();
+		}
+		ready.wait(lock, [&b] { return b.loaded; });
+		for (unsigned i = 0; i < nwords; ++i)
+			mem[(regs.ca + i) & 07777] = b.w[i];
+
+	} else {								// Half blocks are zero filled
+		for (unsigned i = 0; i < Block_Words; ++i)
+			b.w[i] = i < nwords ? mem[(regs.ca + i) & 07777] & 07777 : 0;
+		b.valid = b.loaded = b.dirty = true;
+		++b.gen;
+	}
+
+	regs.ca = (regs.ca + nwords) & 07777;
+	return nwords;
+}
+
+/********************************************************************************************//**
+ * Complete the transfer, or seek, in progress if its time has come.
+ * @return the number of data break cycles
+ ************************************************************************************************/
+unsigned RK8E::poll(unsigned* mem, uint64_t ncycles) {
+	if (!regs.busy || ncycles < regs.doneAt)
+		return 0;
+
+	regs.busy = false;
+	if ((regs.cmd & CMD_FUNC) >> CMD_FUNC_SHIFT == FUNC_SEEK) {
+		if (regs.cmd & CMD_SKDN)
+			regs.status |= STA_DONE;
+		return 0;
+	}
+
+	regs.status |= STA_DONE;
+	return transfer(mem);
+}
+
+/********************************************************************************************//**
+ * IOT 674x; ops, AC in/out, with nbreak set to the number of data break cycles taken.
+ * @return true to skip
+ ************************************************************************************************/
+bool RK8E::iot(unsigned ops, unsigned& ac, unsigned* mem, uint64_t ncycles, unsigned& nbreak) {
+	nbreak = poll(mem, ncycles);
+
+	switch (ops) {
+	case DSKP:
+		return (regs.status & (STA_DONE | STA_ERR)) != 0;
+
+	case DCLR:
+		switch (ac & 3) {
+		case 1:								// Clear all
+			regs.busy = false;
+			regs.cmd = 0;
+			break;
+
+		case 2:								// Recalibrate
+			regs.cyl[(regs.cmd & CMD_UNIT) >> CMD_UNIT_SHIFT] = 0;
+			break;
+
+		default:							// Clear status
+			break;
+		}
+		regs.status = 0;
+		ac = 0;
+		break;
+
+	case DLAG:
+		regs.da = ac;
+		ac = 0;
+		go(ncycles);
+		break;
+
+	case DLCA:
+		regs.ca = ac;
+		ac = 0;
+		break;
+
+	case DRST:
+		ac = regs.status | (regs.busy ? STA_HMOV : 0);
+		break;
+
+	case DLDC:
+		regs.cmd = ac;
+		regs.status = 0;
+		ac = 0;
+		break;
+
+	default:								// DMAN, maintenance, isn't supported
+		break;
+	}
+
+	return false;
+}
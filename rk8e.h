@@ -0,0 +1,117 @@
+/********************************************************************************************//**
+ * @file rk8e.h
+ * 
+ * A PDP-8 Simulator: class RK8E - RK8E disk controller, with up to four RK05 drives
+ ************************************************************************************************/
+
+#ifndef	RK8E_H
+#define	RK8E_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/********************************************************************************************//**
+ * RK8E disk controller
+ *
+ * Cartridge images are plain files of 203 cylinders, by 2 surfaces, by 16 sectors of 256 words,
+ * each word stored as a little endian 16 bit value (as SIMH does).
+ *
+ * Blocks are read, and dirty blocks written back, by a worker thread via pread/pwrite, in to a
+ * per drive block cache. Starting a transfer (DLAG) only queues the block for the worker; the
+ * transfer, by data break, is completed on the processor thread once the modeled seek, rotation
+ * and transfer time has passed, and the program next looks at the controller. So the program
+ * visible status and timing are deterministic, and only wait for the host if the worker hasn't
+ * finished by then. Programs that poll memory, rather than the controller, for completion won't
+ * see the transfer. The cartridges themselves aren't part of a Snapshot, so a run can only be
+ * replayed while no drive is writable().
+ *
+ * Dirty blocks are written back by flush(), asynchronously, or sync(), and when a drive is
+ * detached. A block stays dirty until it's been written successfully, and failures are reported by
+ * the next sync() or detach().
+ ************************************************************************************************/
+class RK8E {
+public:
+	static const unsigned NDrives		= 4;		///< Drives per controller
+	static const unsigned NCylinders	= 203;		///< Cylinders per cartridge
+	static const unsigned NBlocks		= NCylinders * 2 * 16;	///< Blocks per cartridge
+	static const unsigned Block_Words	= 256;		///< Words per block
+
+	/// Controller registers, and the transfer in progress; for checkpoints
+	struct Snapshot {
+		unsigned	cmd;					///< Command register
+		unsigned	ca;						///< Current (memory) address
+		unsigned	da;						///< Disk address
+		unsigned	status;					///< Status register
+		unsigned	cyl[NDrives];			///< Current cylinder, per drive
+		bool		busy;					///< A transfer, or seek, is in progress
+		uint64_t	doneAt;					///< Cycle count when it completes
+	};
+
+	RK8E();
+	~RK8E();
+
+	RK8E(const RK8E&) = delete;
+	RK8E& operator=(const RK8E&) = delete;
+
+	bool attach(unsigned drive, const std::string& filename);
+	bool detach(unsigned drive);
+	void flush();
+	bool sync();
+	bool writable() const;
+
+	bool iot(unsigned ops, unsigned& ac, unsigned* mem, uint64_t ncycles, unsigned& nbreak);
+	unsigned poll(unsigned* mem, uint64_t ncycles);
+
+	Snapshot snapshot() const				{	return regs;	}
+	void restore(const Snapshot& snap)		{	regs = snap;	}
+
+private:
+	/// A cached block
+	struct Block {
+		uint16_t	w[Block_Words];
+		bool		valid;					///< Read, or queued for reading?
+		bool		loaded;					///< w is valid
+		bool		dirty;					///< Needs writing back
+		unsigned	gen;					///< Incremented on every write to w
+	};
+
+	/// A cartridge
+	struct Drive {
+		int					fd;				///< Image file, or -1
+		bool				locked;			///< Write locked
+		std::vector<Block>	cache;			///< Indexed by block number
+	};
+
+	/// A worker request
+	struct Job {
+		enum Kind { Read, Flush, Stop }	kind;
+		unsigned	drive;
+		unsigned	block;
+	};
+
+	Snapshot				regs;
+	Drive					drives[NDrives];
+
+	std::mutex				mtx;			///< Guards jobs, idle, and Block flags
+	std::condition_variable	work;			///< Signaled when a job is queued
+	std::condition_variable	ready;			///< Signaled when a block is loaded, or the queue empty
+	std::deque<Job>			jobs;
+	bool					idle;			///< Worker is waiting for work
+	bool					writeFailed;	///< A write back failed since the last sync()
+	std::thread				worker;
+
+	void run();
+	void load(unsigned drive, unsigned block);
+	void writeBack(unsigned drive);
+	void queue(const Job& job);
+	void go(uint64_t ncycles);
+	unsigned transfer(unsigned* mem);
+	Block& wait(unsigned drive, unsigned block);
+};
+
+#endif
@@ -0,0 +1,67 @@
+/********************************************************************************************//**
+ * @file shmview.cc
+ * 
+ * A PDP-8 Simulator: class ShmView
+ ************************************************************************************************/
+
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "shmview.h"
+
+using namespace std;
+
+static_assert(sizeof(unsigned) == 4, "memory words must be 32 bits");
+static_assert(sizeof(ShmView::Layout) <= 128, "Layout overlaps memory");
+
+/********************************************************************************************//**
+ * Create the shared memory segment /name (or name, if it starts with a '/'), and copy mem in to it
+ * @return false if the segment can't be created; errno is EEXIST if it's already in use
+ ************************************************************************************************/
+bool ShmView::attach(const string& name, const unsigned* mem) {
+	detach();
+
+	shmName = name[0] == '/' ? name : '/' + name;
+	len = Mem_Offset + MemWords * sizeof(unsigned);
+
+	const int fd = shm_open(shmName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd == -1)
+		return false;
+
+	if (ftruncate(fd, len) == -1) {
+		close(fd);
+		shm_unlink(shmName.c_str());
+		return false;
+	}
+
+	void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		shm_unlink(shmName.c_str());
+		return false;
+	}
+
+	seg = new (p) Layout();
+	seg->magic		= Magic;
+	seg->version	= Version;
+	seg->memOffset	= Mem_Offset;
+	seg->memWords	= MemWords;
+	memcpy(memory(), mem, MemWords * sizeof(unsigned));
+
+	return true;
+}
+
+/********************************************************************************************//**
+ * Unmap, and unlink, the segment
+ ************************************************************************************************/
+void ShmView::detach() {
+	if (seg) {
+		munmap(seg, len);
+		shm_unlink(shmName.c_str());
+		seg = nullptr;
+	}
+}
@@ -0,0 +1,141 @@
+/********************************************************************************************//**
+ * @file shmview.h
+ * 
+ * A PDP-8 Simulator: class ShmView - live view of memory and registers in POSIX shared memory
+ ************************************************************************************************/
+
+#ifndef	SHMVIEW_H
+#define	SHMVIEW_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/********************************************************************************************//**
+ * Shared memory live view
+ *
+ * The segment, /name, holds a Layout, version 1:
+ *
+ * Offset | Size | Field
+ * ------ | ---- | -----
+ * 0      | 4    | magic, 'PDP8' (0x38504450)
+ * 4      | 4    | version, 1
+ * 8      | 4    | memOffset, offset of memory, from the start of the segment
+ * 12     | 4    | memWords, 4096
+ * 16     | 4    | seq, the seqlock counter; odd while the registers are being updated
+ * 20     | 4    | pc
+ * 24     | 4    | ac
+ * 28     | 4    | l
+ * 32     | 4    | ma
+ * 36     | 4    | md
+ * 40     | 4    | sr
+ * 44     | 4    | ir, OpCode (0..7)
+ * 48     | 4    | state, State (Fetch = 0, Defer, Execute, Break, WordCount, CurrAddr)
+ * 52     | 4    | reserved
+ * 56     | 8    | ninstr
+ * 64     | 8    | ncycles
+ * 128    | 4 * memWords | memory, one 12 bit word per 32 bit, host endian, word
+ *
+ * The simulator uses the segment's memory as its memory, so memory is always live, and updated
+ * word at a time. The registers and counters are published every PublishInterval instructions,
+ * at an instruction boundary, and whenever the processor stops, or the front panel is entered; so
+ * while running they're at most PublishInterval instructions (around 10 ms of PDP-8 time) stale.
+ * Publishing every instruction would cost more than the rest of the simulation. Monitors should
+ * copy them with read(), which retries until it gets a consistent copy.
+ *
+ * The segment is created exclusively, so two simulators can't share one, and is unlinked when the
+ * simulator exits.
+ ************************************************************************************************/
+class ShmView {
+public:
+	static const uint32_t Magic		= 0x38504450;	///< 'PDP8', little endian
+	static const uint32_t Version	= 1;
+	static const uint32_t MemWords	= 4096;
+	static const uint64_t PublishInterval = 4096;	///< Instructions between publish()es; a power of 2
+
+	/// Registers and counters, as published
+	struct Registers {
+		uint32_t	pc, ac, l, ma, md, sr, ir, state;
+		uint64_t	ninstr, ncycles;
+	};
+
+	/// The segment layout
+	struct Layout {
+		uint32_t				magic;
+		uint32_t				version;
+		uint32_t				memOffset;
+		uint32_t				memWords;
+		std::atomic<uint32_t>	seq;
+		std::atomic<uint32_t>	pc, ac, l, ma, md, sr, ir, state;
+		uint32_t				reserved;
+		std::atomic<uint64_t>	ninstr, ncycles;
+	};
+
+	ShmView() : seg{nullptr}, len{0} {}
+	~ShmView()								{	detach();					}
+
+	ShmView(const ShmView&) = delete;
+	ShmView& operator=(const ShmView&) = delete;
+
+	bool attach(const std::string& name, const unsigned* mem);
+	void detach();
+
+	/// @return the segment's memory, or nullptr if not attached
+	unsigned* memory() const {
+		return seg ? reinterpret_cast<unsigned*>(reinterpret_cast<char*>(seg) + seg->memOffset)
+				   : nullptr;
+	}
+
+	/// Publish the registers and counters
+	void publish(const Registers& regs) {
+		const uint32_t s = seg->seq.load(std::memory_order_relaxed);
+		seg->seq.store(s + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		seg->pc.store(regs.pc, std::memory_order_relaxed);
+		seg->ac.store(regs.ac, std::memory_order_relaxed);
+		seg->l.store(regs.l, std::memory_order_relaxed);
+		seg->ma.store(regs.ma, std::memory_order_relaxed);
+		seg->md.store(regs.md, std::memory_order_relaxed);
+		seg->sr.store(regs.sr, std::memory_order_relaxed);
+		seg->ir.store(regs.ir, std::memory_order_relaxed);
+		seg->state.store(regs.state, std::memory_order_relaxed);
+		seg->ninstr.store(regs.ninstr, std::memory_order_relaxed);
+		seg->ncycles.store(regs.ncycles, std::memory_order_relaxed);
+
+		seg->seq.store(s + 2, std::memory_order_release);
+	}
+
+	/// Monitors: copy a consistent set of registers and counters from seg
+	static void read(const Layout* seg, Registers& regs) {
+		for (;;) {
+			const uint32_t s = seg->seq.load(std::memory_order_acquire);
+			if (s & 1)
+				continue;					// Being updated
+
+			regs.pc			= seg->pc.load(std::memory_order_relaxed);
+			regs.ac			= seg->ac.load(std::memory_order_relaxed);
+			regs.l			= seg->l.load(std::memory_order_relaxed);
+			regs.ma			= seg->ma.load(std::memory_order_relaxed);
+			regs.md			= seg->md.load(std::memory_order_relaxed);
+			regs.sr			= seg->sr.load(std::memory_order_relaxed);
+			regs.ir			= seg->ir.load(std::memory_order_relaxed);
+			regs.state		= seg->state.load(std::memory_order_relaxed);
+			regs.ninstr		= seg->ninstr.load(std::memory_order_relaxed);
+			regs.ncycles	= seg->ncycles.load(std::memory_order_relaxed);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (seg->seq.load(std::memory_order_relaxed) == s)
+				return;
+		}
+	}
+
+private:
+	static const uint32_t Mem_Offset = 128;	///< Offset of memory in the segment
+
+	Layout*			seg;					///< Mapped segment, or nullptr
+	size_t			len;					///< Segment length
+	std::string		shmName;				///< Segment name, for unlinking
+};
+
+#endif